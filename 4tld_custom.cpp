@@ -184,13 +184,96 @@ CUSTOM_COMMAND_SIG(tld_project_show_files) {
     
     view_set_buffer(app, &view, buffer.buffer_id, 0);
     
-    tld_files_state = tld_print_directory(app, &buffer, hot_dir, file_name);
-    view_set_highlight(app, &view, tld_files_state.cells[tld_files_state.selected_index].min,
-                       tld_files_state.cells[tld_files_state.selected_index].max, true);
+    tld_print_directory(app, &buffer, hot_dir, file_name, &tld_files_state);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
+}
+
+// The directory project files are opened from: the project's source
+// directory, or the hot directory if no project is loaded
+static void
+tld_project_files_root(Application_Links *app, String *dest) {
+    dest->size = 0;
+    if (tld_current_project.source_dir.str) {
+        append_ss(dest, tld_current_project.source_dir);
+    } else {
+        dest->size = directory_get_hot(app, dest->str, dest->memory_size);
+    }
+    
+    if (dest->size > 0 &&
+        dest->str[dest->size - 1] != '/' &&
+        dest->str[dest->size - 1] != '\\')
+    {
+        append_s_char(dest, '/');
+    }
+}
+
+// Have the file manager index the project's files in the background
+static void
+tld_project_index_files(Application_Links *app) {
+    char root_space[1024];
+    String root = make_fixed_width_string(root_space);
+    tld_project_files_root(app, &root);
+    tld_files_index_root(app, root);
+}
+
+static tldui_fuzzy_corpus tld_project_file_paths = {0};
+static tldui_fuzzy_memo tld_project_file_path_memo = {0};
+static uint32_t tld_project_file_paths_serial = 0;
+
+CUSTOM_COMMAND_SIG(tld_project_open_file) {
+    char root_space[1024];
+    String root = make_fixed_width_string(root_space);
+    tld_project_files_root(app, &root);
+    tld_files_index_root(app, root);
+    
+    // The paths are taken from the index before the query starts, and left
+    // alone while it runs
+    if (!tld_files_index_paths(root, &tld_project_file_paths, &tld_project_file_paths_serial)) {
+        if (tld_files_index_pending()) {
+            print_message(app, literal("Open Project File: the file index isn't ready yet\n"));
+            return;
+        }
+        
+        // Without an index, walk the tree
+        tld_files_results found = {0};
+        tld_files_walk(app, root, make_lit_string(""), &found);
+        
+        tldui_fuzzy_corpus_free(&tld_project_file_paths);
+        tld_project_file_paths_serial = 0;
+        for (int32_t i = 0; i < found.hit_count; ++i) {
+            tld_files_hit *hit = tld_files_results_get(&found, i);
+            tldui_fuzzy_corpus_push(&tld_project_file_paths, make_string(hit->path, hit->path_size));
+        }
+        tld_files_results_free(&found);
+    }
+    
+    char search_bar_space[TLD_FUZZY_QUERY_CAPACITY];
+    Query_Bar search_bar = {0};
+    search_bar.prompt = make_lit_string("Open Project File: ");
+    search_bar.string = make_fixed_width_string(search_bar_space);
+    
+    start_query_bar(app, &search_bar, 0);
+    int32_t path_index = tldui_query_fuzzy_list(app, &search_bar, &tld_project_file_paths,
+                                                TLD_FUZZY_RESULT_LIMIT,
+                                                &tld_project_file_path_memo);
+    end_query_bar(app, &search_bar, 0);
+    
+    if (path_index >= 0) {
+        String path = tldui_fuzzy_corpus_get(&tld_project_file_paths, path_index);
+        if (root.memory_size - root.size > path.size) {
+            append_ss(&root, path);
+            
+            Buffer_Summary buffer = create_buffer(app, expand_str(root), 0);
+            if (buffer.exists) {
+                View_Summary view = get_active_view(app, AccessAll);
+                view_set_buffer(app, &view, buffer.buffer_id, 0);
+            }
+        }
+    }
 }
 
 CUSTOM_COMMAND_SIG(tld_files_hex_view_selected) {
-    if (tld_files_state.cells == 0) return;
+    if (tld_files_state.cells == 0 || tld_files_state.entry_count == 0) return;
     if (tld_files_state.selected_index < tld_files_state.directory_count) return;
     
     View_Summary view = get_active_view(app, AccessAll);
@@ -200,33 +283,30 @@ CUSTOM_COMMAND_SIG(tld_files_hex_view_selected) {
     String hot_dir make_fixed_width_string(hot_dir_space);
     hot_dir.size = directory_get_hot(app, hot_dir.str, hot_dir.memory_size);
     
-    Range r = tld_files_state.cells[tld_files_state.selected_index];
-    if (hot_dir.memory_size - hot_dir.size > r.max - r.min) {
-        if (buffer_read_range(app, &buffer, r.min, r.max, hot_dir.str + hot_dir.size)) {
-            hot_dir.size += r.max - r.min;
-            Buffer_Summary src_buffer = create_buffer(app, expand_str(hot_dir), 0);
-            if (src_buffer.exists) {
-                free(tld_files_state.cells);
-                tld_files_state = {0};
-                
-                kill_buffer(app, buffer_identifier(buffer.buffer_id),
-                            view.view_id, BufferKill_AlwaysKill);
-                
-                view_set_setting(app, &view, ViewSetting_ShowFileBar, 1);
-                view_set_highlight(app, &view, 0, 0, 0);
+    String name = tld_files_entry_name(&tld_files_state, tld_files_state.selected_index);
+    if (hot_dir.memory_size - hot_dir.size > name.size) {
+        append_ss(&hot_dir, name);
+        Buffer_Summary src_buffer = create_buffer(app, expand_str(hot_dir), 0);
+        if (src_buffer.exists) {
+            tld_files_state_free(&tld_files_state);
+            
+            kill_buffer(app, buffer_identifier(buffer.buffer_id),
+                        view.view_id, BufferKill_AlwaysKill);
+            
+            view_set_setting(app, &view, ViewSetting_ShowFileBar, 1);
+            view_set_highlight(app, &view, 0, 0, 0);
+            
+            tld_HexViewState *state = tld_hex_view_state_make(app, 0, src_buffer.buffer_id);
+            if (state) {
+                int32_t new_cursor_pos = 0;
+                int32_t new_mark_pos = 0;
+                tld_hex_view_print(app, state, true, &new_cursor_pos, &new_mark_pos);
                 
-                tld_HexViewState *state = tld_hex_view_state_make(app, 0, src_buffer.buffer_id);
-                if (state) {
-                    int32_t new_cursor_pos = 0;
-                    int32_t new_mark_pos = 0;
-                    tld_hex_view_print(app, state, true, &new_cursor_pos, &new_mark_pos);
-                    
-                    view_set_buffer(app, &view, state->hex_buffer_id, 0);
-                    view_set_cursor(app, &view, seek_pos(new_cursor_pos), 0);
-                    view_set_mark(app, &view, seek_pos(new_mark_pos));
-                } else {
-                    view_set_buffer(app, &view, src_buffer.buffer_id, 0);
-                }
+                view_set_buffer(app, &view, state->hex_buffer_id, 0);
+                view_set_cursor(app, &view, seek_pos(new_cursor_pos), 0);
+                view_set_mark(app, &view, seek_pos(new_mark_pos));
+            } else {
+                view_set_buffer(app, &view, src_buffer.buffer_id, 0);
             }
         }
     }
@@ -270,6 +350,10 @@ START_HOOK_SIG(tld_start_hook) {
         }
     }
     
+    tld_buffer_index_init(app);
+    if (tld_current_project.source_dir.str) {
+        tld_project_index_files(app);
+    }
     tld_push_default_command_names();
     
     tld_push_named_command(tld_find_and_replace_selection,
@@ -285,6 +369,8 @@ START_HOOK_SIG(tld_start_hook) {
     
     tld_push_named_command(tld_project_show_files,
                            literal("Project: show files"));
+    tld_push_named_command(tld_project_open_file,
+                           literal("Project: open file"));
     tld_push_named_command(tld_project_open_all_code,
                            literal("Project: open all code"));
     tld_push_named_command(tld_reload_project,
@@ -310,6 +396,8 @@ OPEN_FILE_HOOK_SIG(tld_open_file_hook) {
         init_memory(app);
     }
     
+    tld_buffer_index_add(app, buffer_id);
+    
     Buffer_Summary buffer = get_buffer(app, buffer_id, AccessAll);
     
     bool32 treat_as_code = false;
@@ -350,6 +438,7 @@ OPEN_FILE_HOOK_SIG(tld_open_file_hook) {
                                            buffer.file_name,
                                            buffer.file_name_len);
                 exec_command(app, tld_project_open_all_code);
+                tld_project_index_files(app);
             }
             
             if (parse_context_language_cpp == 0) {
@@ -384,6 +473,8 @@ OPEN_FILE_HOOK_SIG(tld_new_file_hook) {
         init_memory(app);
     }
     
+    tld_buffer_index_add(app, buffer_id);
+    
     Buffer_Summary buffer = get_buffer(app, buffer_id, AccessOpen);
     
     if (buffer.file_name != 0 && buffer.size < (16 << 20)) {
@@ -416,6 +507,11 @@ OPEN_FILE_HOOK_SIG(tld_save_file_hook) {
     return 0;
 }
 
+OPEN_FILE_HOOK_SIG(tld_end_file_hook) {
+    tld_buffer_index_remove(buffer_id);
+    return 0;
+}
+
 void tld_bind_keys(Bind_Helper *context) {
     begin_map(context, mapid_global);
     // TODO: Figure out what we are going to use the global map for
@@ -452,6 +548,7 @@ extern "C" int32_t get_bindings(void *data, int32_t size) {
     set_open_file_hook(context, tld_open_file_hook);
     set_new_file_hook(context, tld_new_file_hook);
     set_save_file_hook(context, tld_save_file_hook);
+    set_end_file_hook(context, tld_end_file_hook);
     
     // 4coder default hooks:
     set_hook(context, hook_exit, default_exit);
@@ -11,8 +11,19 @@ publish, and distribute this file as you see fit.
 This file hosts the small commands that depend on nothing but 4tld_user_interface.h.
 
 Preprocessor Variables:
-* TLDUI_CMD_NAME_CAPACITY is the maximum number of named commands that can be
-  registered for use with tld_execute_arbitrary_command_fuzzy.
+* TLD_CMD_USAGE_FILE is the name of the file, next to the 4coder executable,
+  that tld_execute_arbitrary_command_fuzzy keeps its usage counts in, which
+  rank frequently used commands first. This defaults to
+  "4tld_command_usage.bin".
+* TLD_FUZZY_RESULT_LIMIT is the number of ranked results the fuzzy commands let
+  you page through. This defaults to 64.
+* TLD_FUZZY_QUERY_CAPACITY is the maximum length of the patterns typed into the
+  fuzzy commands. This defaults to 1024.
+
+Hooks:
+tld_switch_buffer_fuzzy lists buffers from an index that is only updated when
+tld_buffer_index_add is called from the open and new file hooks, and
+tld_buffer_index_remove from the end file hook, see 4tld_custom.cpp.
   
 Provided Commands:
 * tld_panels_switch_or_create
@@ -29,6 +40,14 @@ Provided Commands:
 
 #include "4tld_user_interface.h"
 
+#ifndef TLD_FUZZY_RESULT_LIMIT
+#define TLD_FUZZY_RESULT_LIMIT 64
+#endif
+
+#ifndef TLD_FUZZY_QUERY_CAPACITY
+#define TLD_FUZZY_QUERY_CAPACITY 1024
+#endif
+
 CUSTOM_COMMAND_SIG(tld_panels_switch_or_create) {
     int view_count = 0;
     
@@ -45,32 +64,228 @@ CUSTOM_COMMAND_SIG(tld_panels_switch_or_create) {
     }
 }
 
-CUSTOM_COMMAND_SIG(tld_switch_buffer_fuzzy) {
-    tldui_string buffer_list[128];
-    int32_t buffer_count = 0;
+// 
+// Buffer Name Index
+// 
+
+// The names of all buffers, in the order they were opened, for
+// tld_switch_buffer_fuzzy. It is kept up to date by tld_buffer_index_add and
+// tld_buffer_index_remove, which the open, new and end file hooks call, so
+// the switcher never has to walk the buffer list itself. Killed buffers are
+// removed from the corpus in place, and the corpus is only rebuilt once they
+// make up half of it.
+// While the switcher's query scores the names, the hooks' updates are queued
+// instead, and applied once the selected buffer was looked up.
+struct tld_buffer_index_update {
+    Buffer_ID buffer_id;
+    bool32 removed;
+};
+
+struct tld_buffer_index {
+    tldui_fuzzy_corpus names;
+    Buffer_ID *buffer_ids; // Parallel to names
+    int32_t capacity;
+    bool32 initialized;
+    
+    bool32 held;
+    tld_buffer_index_update *pending;
+    int32_t pending_count;
+    int32_t pending_capacity;
+    bool32 pending_lost; // Out of memory while queueing; rebuild on release
+};
+
+static tld_buffer_index tld_buffer_names = {0};
+static tldui_fuzzy_memo tld_buffer_name_memo = {0};
+
+static int32_t
+tld_buffer_index_find(tld_buffer_index *index, Buffer_ID buffer_id) {
+    for (int32_t i = index->names.count - 1; i >= 0; --i) {
+        if (index->buffer_ids[i] == buffer_id &&
+            !tldui_fuzzy_corpus_is_removed(&index->names, i))
+        {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+static void
+tld_buffer_index_push(tld_buffer_index *index, Buffer_ID buffer_id, String name) {
+    if (index->names.count >= index->capacity) {
+        int32_t capacity = max(2 * index->capacity, 64);
+        Buffer_ID *buffer_ids = (Buffer_ID *) realloc(index->buffer_ids, sizeof(Buffer_ID) * capacity);
+        if (buffer_ids == 0) return;
+        
+        index->buffer_ids = buffer_ids;
+        index->capacity = capacity;
+    }
+    
+    if (tldui_fuzzy_corpus_push(&index->names, name)) {
+        index->buffer_ids[index->names.count - 1] = buffer_id;
+    }
+}
+
+// Drops removed names, once there are enough of them to make it worthwhile
+static void
+tld_buffer_index_compact(tld_buffer_index *index) {
+    if (index->names.removed_count < 64 ||
+        2 * index->names.removed_count < index->names.count)
+    {
+        return;
+    }
+    
+    tld_buffer_index compacted = {0};
+    for (int32_t i = 0; i < index->names.count; ++i) {
+        if (!tldui_fuzzy_corpus_is_removed(&index->names, i)) {
+            tld_buffer_index_push(&compacted, index->buffer_ids[i],
+                                  tldui_fuzzy_corpus_get(&index->names, i));
+        }
+    }
+    
+    if (compacted.names.count != index->names.count - index->names.removed_count) {
+        // Out of memory; keep the removed names around instead
+        tldui_fuzzy_corpus_free(&compacted.names);
+        free(compacted.buffer_ids);
+        return;
+    }
+    
+    tldui_fuzzy_corpus_free(&index->names);
+    free(index->buffer_ids);
+    index->names = compacted.names;
+    index->buffer_ids = compacted.buffer_ids;
+    index->capacity = compacted.capacity;
+}
+
+static void
+tld_buffer_index_defer(tld_buffer_index *index, Buffer_ID buffer_id, bool32 removed) {
+    if (index->pending_count >= index->pending_capacity) {
+        int32_t capacity = max(2 * index->pending_capacity, 16);
+        tld_buffer_index_update *pending = (tld_buffer_index_update *)
+            realloc(index->pending, sizeof(tld_buffer_index_update) * capacity);
+        if (pending == 0) {
+            index->pending_lost = true;
+            return;
+        }
+        
+        index->pending = pending;
+        index->pending_capacity = capacity;
+    }
+    
+    tld_buffer_index_update *update = &index->pending[index->pending_count++];
+    update->buffer_id = buffer_id;
+    update->removed = removed;
+}
+
+static void
+tld_buffer_index_add(Application_Links *app, Buffer_ID buffer_id) {
+    if (tld_buffer_names.held) {
+        tld_buffer_index_defer(&tld_buffer_names, buffer_id, false);
+        return;
+    }
+    
+    Buffer_Summary buffer = get_buffer(app, buffer_id, AccessAll);
+    if (!buffer.exists) return;
+    
+    String name = make_string(buffer.buffer_name, buffer.buffer_name_len);
+    
+    int32_t i = tld_buffer_index_find(&tld_buffer_names, buffer_id);
+    if (i >= 0) {
+        if (match_ss(name, tldui_fuzzy_corpus_get(&tld_buffer_names.names, i))) return;
+        
+        // The buffer was renamed since
+        tldui_fuzzy_corpus_remove(&tld_buffer_names.names, i);
+    }
+    
+    tld_buffer_index_push(&tld_buffer_names, buffer_id, name);
+}
+
+static void
+tld_buffer_index_remove(Buffer_ID buffer_id) {
+    if (tld_buffer_names.held) {
+        tld_buffer_index_defer(&tld_buffer_names, buffer_id, true);
+        return;
+    }
+    
+    int32_t i = tld_buffer_index_find(&tld_buffer_names, buffer_id);
+    if (i >= 0) {
+        tldui_fuzzy_corpus_remove(&tld_buffer_names.names, i);
+        tld_buffer_index_compact(&tld_buffer_names);
+    }
+}
+
+// Adds the buffers that were created before the hooks were set, such as
+// *messages* and *scratch*. This only walks the buffer list once.
+static void
+tld_buffer_index_init(Application_Links *app) {
+    if (tld_buffer_names.initialized) return;
+    tld_buffer_names.initialized = true;
     
     for (Buffer_Summary buffer = get_buffer_first(app, AccessAll);
-         buffer.exists && buffer_count < 128;
+         buffer.exists;
          get_buffer_next(app, &buffer, AccessAll))
     {
-        buffer_list[buffer_count].value = make_string(buffer.buffer_name, buffer.buffer_name_len);
-        buffer_list[buffer_count].matched_pattern_prefix_length = 0;
-        
-        ++buffer_count;
+        tld_buffer_index_add(app, buffer.buffer_id);
+    }
+}
+
+// Applies the updates queued while the names were held
+static void
+tld_buffer_index_release(Application_Links *app) {
+    tld_buffer_index *index = &tld_buffer_names;
+    index->held = false;
+    
+    if (index->pending_lost) {
+        tldui_fuzzy_corpus_free(&index->names);
+        free(index->buffer_ids);
+        index->buffer_ids = 0;
+        index->capacity = 0;
+        index->initialized = false;
+        tld_buffer_index_init(app);
+    } else {
+        for (int32_t i = 0; i < index->pending_count; ++i) {
+            tld_buffer_index_update *update = &index->pending[i];
+            if (update->removed) {
+                tld_buffer_index_remove(update->buffer_id);
+            } else {
+                tld_buffer_index_add(app, update->buffer_id);
+            }
+        }
     }
     
+    index->pending_count = 0;
+    index->pending_lost = false;
+}
+
+CUSTOM_COMMAND_SIG(tld_switch_buffer_fuzzy) {
+    tld_buffer_index_init(app);
+    
     Query_Bar search_bar;
-    char search_bar_space[TLDUI_MAX_PATTERN_SIZE];
+    char search_bar_space[TLD_FUZZY_QUERY_CAPACITY];
     search_bar.prompt = make_lit_string("Go to Buffer: ");
     search_bar.string = make_fixed_width_string(search_bar_space);
     start_query_bar(app, &search_bar, 0);
     
-    int32_t buffer_name_index = tldui_query_fuzzy_list(app, &search_bar, buffer_list, buffer_count);
+    tld_buffer_names.held = true;
+    int32_t buffer_name_index = tldui_query_fuzzy_list(app, &search_bar, &tld_buffer_names.names,
+                                                       TLD_FUZZY_RESULT_LIMIT,
+                                                       &tld_buffer_name_memo);
+    Buffer_ID buffer_id = 0;
     if (buffer_name_index >= 0) {
-        String buffer_name = buffer_list[buffer_name_index].value;
-        View_Summary view = get_active_view(app, AccessAll);
-        Buffer_Summary buffer = get_buffer_by_name(app, expand_str(buffer_name), AccessAll);
-        view_set_buffer(app, &view, buffer.buffer_id, 0);
+        buffer_id = tld_buffer_names.buffer_ids[buffer_name_index];
+    }
+    tld_buffer_index_release(app);
+    
+    if (buffer_name_index >= 0) {
+        Buffer_Summary buffer = get_buffer(app, buffer_id, AccessAll);
+        
+        if (buffer.exists) {
+            View_Summary view = get_active_view(app, AccessAll);
+            view_set_buffer(app, &view, buffer.buffer_id, 0);
+        } else {
+            // Killed without the end file hook noticing
+            tld_buffer_index_remove(buffer_id);
+        }
     }
 }
 
@@ -308,52 +523,181 @@ CUSTOM_COMMAND_SIG(tld_seek_character_left) {
 // 
 
 typedef Custom_Command_Function * tld_custom_command_function_pointer;
-static tldui_string *tld_command_names = 0;
-static uint32_t tld_command_names_count = 0;
+static tldui_fuzzy_corpus tld_command_names = {0};
+static tldui_fuzzy_memo tld_command_name_memo = {0};
 static tld_custom_command_function_pointer *tld_command_functions = 0;
+static uint32_t *tld_command_uses = 0;
+static int32_t tld_command_capacity = 0;
+static bool32 tld_command_uses_loaded = false;
+
+#ifndef TLD_CMD_USAGE_FILE
+#define TLD_CMD_USAGE_FILE "4tld_command_usage.bin"
+#endif
+
+// Commands that were used more often rank before those that match as well.
+// The bias grows with the logarithm of the use count, so that it only ever
+// decides between matches of about the same quality.
+static inline int32_t
+tld_command_usage_bias(uint32_t uses) {
+    int32_t bias = 0;
+    while (uses > 0 && bias < 8) {
+        uses >>= 1;
+        bias += 1;
+    }
+    return bias;
+}
+
+static bool32
+tld_command_usage_file_name(Application_Links *app, String *dest) {
+    dest->size = get_4ed_path(app, dest->str, dest->memory_size);
+    if (dest->size <= 0) return false;
+    
+    append_sc(dest, "/");
+    append_sc(dest, TLD_CMD_USAGE_FILE);
+    return terminate_with_null(dest);
+}
+
+// The usage file starts with the magic number and the record count, followed
+// by one record per command that was ever used: its use count, the length of
+// its name, and the name itself. Records are matched to commands by name, so
+// they stay valid as commands are added or reordered.
+#define TLD_CMD_USAGE_MAGIC 0x55434454 // "TDCU"
+
+static void
+tld_load_command_uses(Application_Links *app) {
+    tld_command_uses_loaded = true;
+    
+    char file_name_space[1024];
+    String file_name = make_fixed_width_string(file_name_space);
+    if (!tld_command_usage_file_name(app, &file_name)) return;
+    
+    FILE *file = fopen(file_name.str, "rb");
+    if (file == 0) return;
+    
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, file) == 1 && header[0] == TLD_CMD_USAGE_MAGIC) {
+        for (uint32_t r = 0; r < header[1]; ++r) {
+            uint32_t uses;
+            uint16_t name_len;
+            char name_space[256];
+            
+            if (fread(&uses, sizeof(uses), 1, file) != 1) break;
+            if (fread(&name_len, sizeof(name_len), 1, file) != 1) break;
+            if (name_len > sizeof(name_space)) break;
+            if (fread(name_space, 1, name_len, file) != name_len) break;
+            
+            String name = make_string(name_space, name_len);
+            for (int32_t i = 0; i < tld_command_names.count; ++i) {
+                if (match_ss(name, tldui_fuzzy_corpus_get(&tld_command_names, i))) {
+                    tld_command_uses[i] = uses;
+                    tldui_fuzzy_corpus_set_bias(&tld_command_names, i, tld_command_usage_bias(uses));
+                    break;
+                }
+            }
+        }
+    }
+    
+    fclose(file);
+}
+
+// The counts are written to a temporary file that then replaces the old one,
+// so a failed or interrupted save never leaves a truncated usage file behind.
+static void
+tld_save_command_uses(Application_Links *app) {
+    char file_name_space[1024];
+    String file_name = make_fixed_width_string(file_name_space);
+    if (!tld_command_usage_file_name(app, &file_name)) return;
+    
+    char temp_name_space[1024];
+    String temp_name = make_fixed_width_string(temp_name_space);
+    if (!append_ss(&temp_name, file_name)) return;
+    if (!append_sc(&temp_name, ".tmp")) return;
+    if (!terminate_with_null(&temp_name)) return;
+    
+    FILE *file = fopen(temp_name.str, "wb");
+    if (file == 0) return;
+    
+    uint32_t header[2] = {TLD_CMD_USAGE_MAGIC, 0};
+    for (int32_t i = 0; i < tld_command_names.count; ++i) {
+        if (tld_command_uses[i] > 0) header[1] += 1;
+    }
+    bool32 written = (fwrite(header, sizeof(header), 1, file) == 1);
+    
+    for (int32_t i = 0; written && i < tld_command_names.count; ++i) {
+        if (tld_command_uses[i] == 0) continue;
+        
+        String name = tldui_fuzzy_corpus_get(&tld_command_names, i);
+        uint16_t name_len = (uint16_t) min(name.size, 256);
+        written = (fwrite(&tld_command_uses[i], sizeof(uint32_t), 1, file) == 1 &&
+                   fwrite(&name_len, sizeof(name_len), 1, file) == 1 &&
+                   fwrite(name.str, 1, name_len, file) == name_len);
+    }
+    
+    if (fclose(file) != 0) written = false;
+    if (written) {
+#ifdef _WIN32
+        // rename doesn't replace existing files on Windows
+        remove(file_name.str);
+#endif
+        written = (rename(temp_name.str, file_name.str) == 0);
+    }
+    if (!written) {
+        remove(temp_name.str);
+    }
+}
 
 CUSTOM_COMMAND_SIG(tld_execute_arbitrary_command_fuzzy) {
-    if (tld_command_functions == 0) return;
+    if (tld_command_names.count == 0) return;
+    if (!tld_command_uses_loaded) {
+        tld_load_command_uses(app);
+    }
     
-    char search_bar_space[TLDUI_MAX_PATTERN_SIZE];
+    char search_bar_space[TLD_FUZZY_QUERY_CAPACITY];
     Query_Bar search_bar = {0};
     search_bar.prompt = make_lit_string("Command: ");
     search_bar.string = make_fixed_width_string(search_bar_space);
     
     start_query_bar(app, &search_bar, 0);
-    int32_t command_index = tldui_query_fuzzy_list(app, &search_bar,
-                                                   tld_command_names,
-                                                   tld_command_names_count);
+    int32_t command_index = tldui_query_fuzzy_list(app, &search_bar, &tld_command_names,
+                                                   TLD_FUZZY_RESULT_LIMIT,
+                                                   &tld_command_name_memo);
     end_query_bar(app, &search_bar, 0);
     
     if (command_index >= 0) {
+        uint32_t uses = tld_command_uses[command_index] + 1;
+        if (uses > 0) {
+            tld_command_uses[command_index] = uses;
+            tldui_fuzzy_corpus_set_bias(&tld_command_names, command_index,
+                                        tld_command_usage_bias(uses));
+            tld_save_command_uses(app);
+        }
+        
         exec_command(app, tld_command_functions[command_index]);
     }
 }
 
-#ifndef TLD_CMD_NAME_CAPACITY
-#define TLD_CMD_NAME_CAPACITY 128
-#endif
-
 static inline bool32
 tld_push_named_command(Custom_Command_Function *cmd, char *cmd_name, int32_t cmd_name_len) {
-    if (tld_command_names == 0) {
-        tld_command_names = (tldui_string *) malloc(
-            sizeof(tldui_string) * TLD_CMD_NAME_CAPACITY);
-    }
-    
-    if (tld_command_functions == 0) {
-        tld_command_functions = (tld_custom_command_function_pointer *) malloc(
-            sizeof(tld_custom_command_function_pointer) * TLD_CMD_NAME_CAPACITY);
-    }
-    
-    if (tld_command_names_count < TLD_CMD_NAME_CAPACITY) {
-        tld_command_names[tld_command_names_count] = {0};
-        tld_command_names[tld_command_names_count].value = make_string(cmd_name, cmd_name_len);
+    if (tld_command_names.count >= tld_command_capacity) {
+        int32_t capacity = max(2 * tld_command_capacity, 128);
         
-        tld_command_functions[tld_command_names_count] = cmd;
+        // A failed realloc leaves the registry as it was: the capacity and the
+        // name only move once both arrays have grown.
+        tld_custom_command_function_pointer *functions = (tld_custom_command_function_pointer *) realloc(
+            tld_command_functions, sizeof(tld_custom_command_function_pointer) * capacity);
+        if (functions == 0) return false;
+        tld_command_functions = functions;
         
-        ++tld_command_names_count;
+        uint32_t *uses = (uint32_t *) realloc(tld_command_uses, sizeof(uint32_t) * capacity);
+        if (uses == 0) return false;
+        tld_command_uses = uses;
+        
+        tld_command_capacity = capacity;
+    }
+    
+    if (tldui_fuzzy_corpus_push(&tld_command_names, make_string(cmd_name, cmd_name_len))) {
+        tld_command_functions[tld_command_names.count - 1] = cmd;
+        tld_command_uses[tld_command_names.count - 1] = 0;
         return true;
     }
     
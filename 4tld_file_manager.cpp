@@ -11,214 +11,2761 @@ publish, and distribute this file as you see fit.
 
 #include "4tld_user_interface.h"
 
+// 
+// Search Results
+// 
+
+// Recursive searches keep every file that matches, with its score. Hits are
+// stored in chunks of TLDFM_HIT_CHUNK_SIZE, and their paths in blocks of at
+// least TLDFM_HIT_PATH_BLOCK_SIZE bytes, so nothing that was found moves as
+// more is. The hits are shown best first, but only the best
+// TLDFM_SEARCH_RESULT_STEP become entries of the file manager at first, and
+// the next ones once the last entry is selected.
+
+#ifndef TLDFM_HIT_CHUNK_SIZE
+#define TLDFM_HIT_CHUNK_SIZE 4096
+#endif
+
+#ifndef TLDFM_HIT_PATH_BLOCK_SIZE
+#define TLDFM_HIT_PATH_BLOCK_SIZE (64 << 10)
+#endif
+
+#ifndef TLDFM_SEARCH_RESULT_STEP
+#define TLDFM_SEARCH_RESULT_STEP 512
+#endif
+
+struct tld_files_hit {
+    char *path;
+    int32_t path_size;
+    int32_t score;
+};
+
+struct tld_files_hit_chunk {
+    tld_files_hit hits[TLDFM_HIT_CHUNK_SIZE];
+};
+
+// The paths follow the header
+struct tld_files_path_block {
+    tld_files_path_block *next;
+    int32_t size;
+    int32_t capacity;
+};
+
+struct tld_files_results {
+    tld_files_hit_chunk **chunks;
+    int32_t chunk_count;
+    int32_t chunk_capacity;
+    int32_t hit_count;
+    
+    // The blocks holding the hits' paths, newest first. Hits can also point
+    // into the blocks of another tld_files_results.
+    tld_files_path_block *paths;
+};
+
+static inline tld_files_hit *
+tld_files_results_get(tld_files_results *results, int32_t index) {
+    return &results->chunks[index / TLDFM_HIT_CHUNK_SIZE]->hits[index % TLDFM_HIT_CHUNK_SIZE];
+}
+
+static bool32
+tld_files_results_push_hit(tld_files_results *results, tld_files_hit hit) {
+    int32_t chunk = results->hit_count / TLDFM_HIT_CHUNK_SIZE;
+    if (chunk == results->chunk_count) {
+        if (chunk == results->chunk_capacity) {
+            int32_t capacity = max(2 * results->chunk_capacity, 16);
+            tld_files_hit_chunk **chunks = (tld_files_hit_chunk **)
+                realloc(results->chunks, capacity * sizeof(tld_files_hit_chunk *));
+            if (chunks == 0) return false;
+            
+            results->chunks = chunks;
+            results->chunk_capacity = capacity;
+        }
+        
+        results->chunks[chunk] = (tld_files_hit_chunk *) malloc(sizeof(tld_files_hit_chunk));
+        if (results->chunks[chunk] == 0) return false;
+        results->chunk_count += 1;
+    }
+    
+    *tld_files_results_get(results, results->hit_count++) = hit;
+    return true;
+}
+
+// Adds a hit at the path prefix followed by name
+static bool32
+tld_files_results_push(tld_files_results *results, String prefix, String name, int32_t score) {
+    int32_t size = prefix.size + name.size;
+    tld_files_path_block *block = results->paths;
+    
+    if (block == 0 || block->capacity - block->size < size) {
+        int32_t capacity = max(size, TLDFM_HIT_PATH_BLOCK_SIZE);
+        block = (tld_files_path_block *) malloc(sizeof(tld_files_path_block) + capacity);
+        if (block == 0) return false;
+        
+        block->next = results->paths;
+        block->size = 0;
+        block->capacity = capacity;
+        results->paths = block;
+    }
+    
+    tld_files_hit hit;
+    hit.path = (char *)(block + 1) + block->size;
+    hit.path_size = size;
+    hit.score = score;
+    if (prefix.size) memcpy(hit.path, prefix.str, prefix.size);
+    if (name.size) memcpy(hit.path + prefix.size, name.str, name.size);
+    
+    if (!tld_files_results_push_hit(results, hit)) return false;
+    block->size += size;
+    
+    return true;
+}
+
+// Makes dest responsible for freeing the blocks of src's paths
+static void
+tld_files_results_take_paths(tld_files_results *dest, tld_files_results *src) {
+    tld_files_path_block **last = &src->paths;
+    while (*last) last = &(*last)->next;
+    
+    *last = dest->paths;
+    dest->paths = src->paths;
+    src->paths = 0;
+}
+
+static void
+tld_files_results_free(tld_files_results *results) {
+    for (int32_t i = 0; i < results->chunk_count; ++i) {
+        free(results->chunks[i]);
+    }
+    free(results->chunks);
+    
+    while (results->paths) {
+        tld_files_path_block *next = results->paths->next;
+        free(results->paths);
+        results->paths = next;
+    }
+    
+    *results = {0};
+}
+
+// Moves the hits of src over to dest, after the ones it has, leaving src empty
+static bool32
+tld_files_results_merge(tld_files_results *dest, tld_files_results *src) {
+    bool32 result = true;
+    for (int32_t i = 0; result && i < src->hit_count; ++i) {
+        result = tld_files_results_push_hit(dest, *tld_files_results_get(src, i));
+    }
+    
+    tld_files_results_take_paths(dest, src);
+    tld_files_results_free(src);
+    
+    return result;
+}
+
 // TODO: Store the hot_directory with the state, so that we don't glitch when the hot directory is changed underneath us
 
-struct tld_file_manager_state {
-    Range * cells;
-    int32_t entry_count;
-    int32_t directory_count;
-    int32_t selected_index;
-    bool32 showing_search_results;
-};
+struct tld_file_manager_state {
+    // The ranges of the entries whose rows are printed
+    Range * cells;
+    int32_t cells_capacity;
+    int32_t entry_count;
+    int32_t directory_count;
+    int32_t selected_index;
+    bool32 showing_search_results;
+    
+    // The entries' names, back to back. Entry i's name starts at name_starts[i]
+    char * names;
+    int32_t names_size;
+    int32_t names_capacity;
+    int32_t * name_starts;
+    int32_t name_starts_capacity;
+    
+    // Row i shows the entries [row_entries[i], row_entries[i + 1]),
+    // divider_row shows the divider between directories and files instead
+    int32_t * row_entries;
+    int32_t row_entries_capacity;
+    int32_t row_count;
+    int32_t divider_row;
+    
+    tldui_vlist list;
+    
+    // Every hit of the search shown, see tld_files_results_show
+    tld_files_results results;
+};
+
+char tld_files_dir_header[] =
+"\n===[ Directories ]=========================================================================\n";
+char tld_files_divider[] = "===[ Files ]===============================================================================\n";
+
+static void
+tld_files_state_free(tld_file_manager_state *state) {
+    free(state->cells);
+    free(state->names);
+    free(state->name_starts);
+    free(state->row_entries);
+    tld_files_results_free(&state->results);
+    *state = {0};
+}
+
+static inline String
+tld_files_entry_name(tld_file_manager_state *state, int32_t index) {
+    int32_t start = state->name_starts[index];
+    return make_string(state->names + start, state->name_starts[index + 1] - start);
+}
+
+// Appends an entry named prefix followed by name
+static bool32
+tld_files_push_entry(tld_file_manager_state *state, String prefix, String name) {
+    int32_t size = prefix.size + name.size;
+    if (state->names_capacity - state->names_size < size) {
+        int32_t capacity = max(max(2 * state->names_capacity, state->names_size + size), 4096);
+        char *names = (char *) realloc(state->names, capacity);
+        if (names == 0) return false;
+        
+        state->names = names;
+        state->names_capacity = capacity;
+    }
+    
+    if (state->name_starts_capacity < state->entry_count + 2) {
+        int32_t capacity = max(2 * state->name_starts_capacity, 256);
+        int32_t *name_starts = (int32_t *) realloc(state->name_starts, capacity * sizeof(int32_t));
+        if (name_starts == 0) return false;
+        
+        state->name_starts = name_starts;
+        state->name_starts_capacity = capacity;
+    }
+    
+    char *dest = state->names + state->names_size;
+    if (prefix.size) memcpy(dest, prefix.str, prefix.size);
+    if (name.size) memcpy(dest + prefix.size, name.str, name.size);
+    
+    state->name_starts[state->entry_count] = state->names_size;
+    state->names_size += size;
+    state->entry_count += 1;
+    state->name_starts[state->entry_count] = state->names_size;
+    
+    return true;
+}
+
+// Makes the best count hits in results entries of state, best first, or as
+// many as memory allows. The entries state has are expected to be the best
+// hits already, as tld_files_results_show made them.
+static void
+tld_files_results_show(tld_files_results *results, tld_file_manager_state *state, int32_t count) {
+    count = min(count, results->hit_count);
+    if (state->entry_count >= count) return;
+    
+    int32_t *memory = (int32_t *) malloc(2 * count * sizeof(int32_t));
+    if (memory == 0) return;
+    
+    tldui_top_k top = tldui_make_top_k(memory, memory + count, count);
+    for (int32_t i = 0; i < results->hit_count; ++i) {
+        tldui_top_k_insert(&top, i, tld_files_results_get(results, i)->score);
+    }
+    tldui_top_k_sort(&top);
+    
+    for (int32_t i = state->entry_count; i < top.count; ++i) {
+        tld_files_hit *hit = tld_files_results_get(results, top.indices[i]);
+        if (!tld_files_push_entry(state, {0}, make_string(hit->path, hit->path_size))) break;
+    }
+    
+    free(memory);
+}
+
+// Breaks the entries into rows: one per search result, or tables of
+// directories and files, as wide as the table printer would make them
+static bool32
+tld_files_layout(tld_file_manager_state *state) {
+    // Grown, rather than allocated anew, as more search results are shown
+    if (state->cells == 0 || state->cells_capacity < state->entry_count) {
+        int32_t capacity = max(max(2 * state->cells_capacity, state->entry_count), 64);
+        Range *cells = (Range *) realloc(state->cells, capacity * sizeof(Range));
+        if (cells == 0) return false;
+        
+        state->cells = cells;
+        state->cells_capacity = capacity;
+    }
+    
+    if (state->row_entries_capacity < state->entry_count + 2) {
+        int32_t capacity = max(max(2 * state->row_entries_capacity, state->entry_count + 2), 64);
+        int32_t *row_entries = (int32_t *) realloc(state->row_entries, capacity * sizeof(int32_t));
+        if (row_entries == 0) return false;
+        
+        state->row_entries = row_entries;
+        state->row_entries_capacity = capacity;
+    }
+    
+    state->row_count = 0;
+    state->divider_row = -1;
+    
+    if (state->showing_search_results) {
+        for (int32_t i = 0; i < state->entry_count; ++i) {
+            state->row_entries[state->row_count++] = i;
+        }
+    } else {
+        tldui_table_printer printer = tldui_make_table(0, 30, 3);
+        for (int32_t i = 0; i <= state->entry_count; ++i) {
+            if (i == state->directory_count) {
+                state->divider_row = state->row_count;
+                state->row_entries[state->row_count++] = i;
+                printer.current_column = 0;
+            }
+            if (i == state->entry_count) break;
+            
+            bool32 starts_table = printer.current_column == 0;
+            if (tldui_layout_table_cell(&printer, tld_files_entry_name(state, i).size) ||
+                starts_table)
+            {
+                state->row_entries[state->row_count++] = i;
+            }
+        }
+    }
+    
+    state->row_entries[state->row_count] = state->entry_count;
+    return true;
+}
+
+static int32_t
+tld_files_entry_row(tld_file_manager_state *state, int32_t index) {
+    int32_t lo = 0, hi = state->row_count - 1;
+    while (lo < hi) {
+        int32_t mid = (lo + hi + 1) / 2;
+        if (state->row_entries[mid] <= index) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    
+    return lo;
+}
+
+// Returns the closest row in the direction of step that has any entries,
+// or -1 if there is none
+static int32_t
+tld_files_next_entry_row(tld_file_manager_state *state, int32_t row, int32_t step) {
+    for (row += step; 0 <= row && row < state->row_count; row += step) {
+        if (state->row_entries[row] < state->row_entries[row + 1]) return row;
+    }
+    
+    return -1;
+}
+
+static void
+tld_files_print_row(tldui_batch *batch, int32_t row, void *user_data) {
+    tld_file_manager_state *state = (tld_file_manager_state *) user_data;
+    
+    if (row == state->divider_row) {
+        tldui_batch_print_text(batch, literal(tld_files_divider));
+        return;
+    }
+    
+    tldui_table_printer printer = tldui_make_table(batch, 30, 3);
+    for (int32_t i = state->row_entries[row]; i < state->row_entries[row + 1]; ++i) {
+        String name = tld_files_entry_name(state, i);
+        if (state->showing_search_results) {
+            state->cells[i] = tldui_batch_print_text(batch, expand_str(name));
+        } else {
+            state->cells[i] = tldui_print_table_cell(&printer, name);
+        }
+    }
+    
+    tldui_batch_print_text(batch, literal("\n"));
+}
+
+// Replaces the buffer's contents with the title, the header and the rows
+// around the selected entry
+static void
+tld_files_print(Application_Links *app, Buffer_Summary *buffer, tld_file_manager_state *state,
+                String title, char *header, int32_t header_length)
+{
+    tldui_batch batch = tldui_begin_batch(buffer, make_range(0, buffer->size));
+    tldui_batch_print_text(&batch, expand_str(title));
+    tldui_batch_print_text(&batch, header, header_length);
+    
+    tldui_vlist_init(&state->list, tldui_batch_pos(&batch), state->row_count,
+                     tld_files_print_row, state);
+    tldui_vlist_print_window(&state->list, &batch,
+                             tld_files_entry_row(state, state->selected_index) - TLDUI_VLIST_WINDOW / 2);
+    
+    tldui_end_batch(app, &batch);
+}
+
+// 
+// Directory Cache
+// 
+
+// The listings of the last TLDFM_DIR_CACHE_SIZE directories shown are kept in
+// memory, and printed from there when the directory is shown again. Each of
+// them is watched with inotify and dropped as soon as the directory changes.
+// Note that inotify only sees changes made through this machine, so on network
+// file systems, tld_files_refresh may be needed to see other machines' changes.
+
+#ifndef TLDFM_DIR_CACHE_SIZE
+#ifdef __linux__
+#define TLDFM_DIR_CACHE_SIZE 16
+#else
+#define TLDFM_DIR_CACHE_SIZE 0
+#endif
+#endif
+
+#if TLDFM_DIR_CACHE_SIZE > 0
+#include <sys/inotify.h>
+#include <unistd.h>
+
+struct tld_files_cached_dir {
+    char *path;
+    int32_t path_size;
+    int watch;
+    uint32_t last_used;
+    
+    char *names;
+    int32_t names_size;
+    int32_t *name_starts;
+    int32_t entry_count;
+    int32_t directory_count;
+};
+
+struct tld_files_dir_cache {
+    tld_files_cached_dir dirs[TLDFM_DIR_CACHE_SIZE];
+    int inotify_fd;
+    uint32_t clock;
+    bool32 initialized;
+};
+
+static tld_files_dir_cache tld_files_cache = {0};
+
+// The cache key, without trailing slashes
+static inline String
+tld_files_dir_cache_key(String dir) {
+    while (dir.size > 1 && (dir.str[dir.size - 1] == '/' || dir.str[dir.size - 1] == '\\')) {
+        dir.size -= 1;
+    }
+    
+    return dir;
+}
+
+static int32_t
+tld_files_dir_cache_find(tld_files_dir_cache *cache, String key) {
+    for (int32_t i = 0; i < TLDFM_DIR_CACHE_SIZE; ++i) {
+        tld_files_cached_dir *dir = &cache->dirs[i];
+        if (dir->path && match_ss(make_string(dir->path, dir->path_size), key)) return i;
+    }
+    
+    return -1;
+}
+
+// Frees a cached listing, and stops watching its directory unless another
+// cached path leads there, too
+static void
+tld_files_dir_cache_drop(tld_files_dir_cache *cache, int32_t slot) {
+    tld_files_cached_dir *dir = &cache->dirs[slot];
+    if (dir->path == 0) return;
+    
+    bool32 watch_shared = false;
+    for (int32_t i = 0; i < TLDFM_DIR_CACHE_SIZE; ++i) {
+        if (i != slot && cache->dirs[i].path && cache->dirs[i].watch == dir->watch) {
+            watch_shared = true;
+        }
+    }
+    if (!watch_shared && dir->watch >= 0) inotify_rm_watch(cache->inotify_fd, dir->watch);
+    
+    free(dir->path);
+    free(dir->names);
+    free(dir->name_starts);
+    *dir = {0};
+}
+
+// Drops the listings of all directories that changed since the last call
+static void
+tld_files_dir_cache_sync(tld_files_dir_cache *cache) {
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } events;
+    
+    while (true) {
+        ssize_t size = read(cache->inotify_fd, events.bytes, sizeof(events.bytes));
+        if (size <= 0) break;
+        
+        for (char *at = events.bytes; at < events.bytes + size;) {
+            struct inotify_event *event = (struct inotify_event *) at;
+            
+            for (int32_t i = 0; i < TLDFM_DIR_CACHE_SIZE; ++i) {
+                tld_files_cached_dir *dir = &cache->dirs[i];
+                if (dir->path && (dir->watch == event->wd || (event->mask & IN_Q_OVERFLOW))) {
+                    // The kernel already removed the watches it reports as ignored
+                    if (event->mask & IN_IGNORED) dir->watch = -1;
+                    tld_files_dir_cache_drop(cache, i);
+                }
+            }
+            
+            at += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+// Fills state with the cached listing of dir, if there is one.
+// Returns whether there was.
+static bool32
+tld_files_dir_cache_load(String dir, tld_file_manager_state *state) {
+    tld_files_dir_cache *cache = &tld_files_cache;
+    if (!cache->initialized) {
+        cache->initialized = true;
+        cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    if (cache->inotify_fd < 0) return false;
+    
+    tld_files_dir_cache_sync(cache);
+    
+    int32_t slot = tld_files_dir_cache_find(cache, tld_files_dir_cache_key(dir));
+    if (slot < 0) return false;
+    
+    tld_files_cached_dir *cached = &cache->dirs[slot];
+    cached->last_used = ++cache->clock;
+    
+    state->names = (char *) malloc(max(cached->names_size, 1));
+    state->name_starts = (int32_t *) malloc((cached->entry_count + 1) * sizeof(int32_t));
+    if (state->names == 0 || state->name_starts == 0) {
+        tld_files_state_free(state);
+        return false;
+    }
+    
+    memcpy(state->names, cached->names, cached->names_size);
+    memcpy(state->name_starts, cached->name_starts, (cached->entry_count + 1) * sizeof(int32_t));
+    state->names_size = cached->names_size;
+    state->names_capacity = max(cached->names_size, 1);
+    state->name_starts_capacity = cached->entry_count + 1;
+    state->entry_count = cached->entry_count;
+    state->directory_count = cached->directory_count;
+    
+    return true;
+}
+
+// Starts watching dir, so that it can be cached once it's been listed.
+// Call this _before_ listing the directory, or changes made in between are
+// missed. Returns the slot to pass to tld_files_dir_cache_store, or -1 if the
+// directory can't be watched.
+static int32_t
+tld_files_dir_cache_watch(String dir) {
+    tld_files_dir_cache *cache = &tld_files_cache;
+    if (!cache->initialized || cache->inotify_fd < 0) return -1;
+    
+    String key = tld_files_dir_cache_key(dir);
+    char *path = (char *) malloc(key.size + 1);
+    if (path == 0) return -1;
+    
+    memcpy(path, key.str, key.size);
+    path[key.size] = 0;
+    
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    int watch = inotify_add_watch(cache->inotify_fd, path, mask);
+    if (watch < 0) {
+        free(path);
+        return -1;
+    }
+    
+    int32_t slot = tld_files_dir_cache_find(cache, key);
+    if (slot < 0) {
+        slot = 0;
+        for (int32_t i = 0; i < TLDFM_DIR_CACHE_SIZE; ++i) {
+            if (cache->dirs[i].path == 0) {
+                slot = i;
+                break;
+            }
+            if (cache->dirs[i].last_used < cache->dirs[slot].last_used) slot = i;
+        }
+    }
+    
+    // Don't let dropping the old listing remove the watch we just added
+    if (cache->dirs[slot].watch == watch) cache->dirs[slot].watch = -1;
+    tld_files_dir_cache_drop(cache, slot);
+    
+    cache->dirs[slot].watch = watch;
+    cache->dirs[slot].path = path;
+    cache->dirs[slot].path_size = key.size;
+    cache->dirs[slot].last_used = ++cache->clock;
+    
+    return slot;
+}
+
+// Keeps a copy of the listing in state in the slot tld_files_dir_cache_watch
+// returned. The listing isn't kept if the directory changed in the meantime.
+static void
+tld_files_dir_cache_store(int32_t slot, tld_file_manager_state *state) {
+    tld_files_dir_cache *cache = &tld_files_cache;
+    if (slot < 0) return;
+    
+    tld_files_dir_cache_sync(cache);
+    
+    tld_files_cached_dir *cached = &cache->dirs[slot];
+    if (cached->path == 0) return;
+    
+    cached->names = (char *) malloc(max(state->names_size, 1));
+    cached->name_starts = (int32_t *) malloc((state->entry_count + 1) * sizeof(int32_t));
+    if (cached->names == 0 || cached->name_starts == 0) {
+        tld_files_dir_cache_drop(cache, slot);
+        return;
+    }
+    
+    memcpy(cached->names, state->names, state->names_size);
+    if (state->entry_count) {
+        memcpy(cached->name_starts, state->name_starts, (state->entry_count + 1) * sizeof(int32_t));
+    } else {
+        cached->name_starts[0] = 0;
+    }
+    cached->names_size = state->names_size;
+    cached->entry_count = state->entry_count;
+    cached->directory_count = state->directory_count;
+}
+
+static void
+tld_files_dir_cache_forget(String dir) {
+    tld_files_dir_cache *cache = &tld_files_cache;
+    if (!cache->initialized || cache->inotify_fd < 0) return;
+    
+    int32_t slot = tld_files_dir_cache_find(cache, tld_files_dir_cache_key(dir));
+    if (slot >= 0) tld_files_dir_cache_drop(cache, slot);
+}
+
+#else
+
+static inline bool32 tld_files_dir_cache_load(String dir, tld_file_manager_state *state) { return false; }
+static inline int32_t tld_files_dir_cache_watch(String dir) { return -1; }
+static inline void tld_files_dir_cache_store(int32_t slot, tld_file_manager_state *state) {}
+static inline void tld_files_dir_cache_forget(String dir) {}
+
+#endif
+
+// Fills state with the directories, then the files in dir
+static bool32
+tld_files_list_directory(Application_Links *app, String dir, tld_file_manager_state *state) {
+    File_List contents = get_file_list(app, expand_str(dir));
+    
+    for (uint32_t i = 0; i < contents.count; ++i) {
+        if (contents.infos[i].folder) {
+            String file_name = make_string(contents.infos[i].filename, contents.infos[i].filename_len);
+            state->directory_count += 1;
+            tld_files_push_entry(state, {0}, file_name);
+        }
+    }
+    
+    for (uint32_t i = 0; i < contents.count; ++i) {
+        if (!contents.infos[i].folder) {
+            String file_name = make_string(contents.infos[i].filename, contents.infos[i].filename_len);
+            tld_files_push_entry(state, {0}, file_name);
+        }
+    }
+    
+    free_file_list(app, contents);
+    return state->entry_count == (int32_t) contents.count;
+}
+
+static void
+tld_print_directory(Application_Links *app,
+                    Buffer_Summary *buffer,
+                    String dir, String needle_file,
+                    tld_file_manager_state *state)
+{
+    tld_files_state_free(state);
+    
+    if (!tld_files_dir_cache_load(dir, state)) {
+        int32_t cache_slot = tld_files_dir_cache_watch(dir);
+        if (!tld_files_list_directory(app, dir, state)) {
+            tld_files_dir_cache_forget(dir);
+            tld_files_state_free(state);
+            return;
+        }
+        tld_files_dir_cache_store(cache_slot, state);
+    }
+    
+    if (needle_file.str) {
+        for (int32_t i = 0; i < state->entry_count; ++i) {
+            if (match_ss(tld_files_entry_name(state, i), needle_file)) {
+                state->selected_index = i;
+                break;
+            }
+        }
+    }
+    
+    if (!tld_files_layout(state)) {
+        tld_files_state_free(state);
+        return;
+    }
+    
+    tld_files_print(app, buffer, state, dir, literal(tld_files_dir_header));
+}
+
+// 
+// Parallel Directory Walk
+// 
+
+// Recursive searches read directories on all of the fuzzy matcher's worker
+// threads. Each worker keeps a deque of directories it has yet to read, takes
+// the newest one from its own deque and steals the oldest one from the others'
+// when it runs dry. Directories are read with getdents64 rather than
+// get_file_list, which would have to stat every entry.
+// With TLDUI_MAX_WORKER_COUNT set to 1, and outside of Linux, the tree is
+// walked depth-first with get_file_list instead.
+
+#if defined(__linux__) && TLDUI_MAX_WORKER_COUNT > 1
+#define TLDFM_PARALLEL_WALK 1
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// A directory left to read, with a trailing slash
+struct tld_walk_dir {
+    char *path;
+    int32_t size;
+};
+
+// The owner pushes and pops at the bottom, thieves steal from the top
+struct tld_walk_deque {
+    pthread_mutex_t mutex;
+    tld_walk_dir *dirs;
+    int32_t top;
+    int32_t bottom;
+    int32_t capacity;
+};
+
+struct tld_walk_worker {
+    tld_walk_deque deque;
+    tld_fuzzy_scratch scratch;
+    tld_files_results hits;
+    
+    // Subdirectories of the directory being read, pushed once it's done
+    tld_walk_dir *found;
+    int32_t found_count;
+    int32_t found_capacity;
+};
+
+struct tld_walk {
+    tld_walk_worker workers[TLDUI_MAX_WORKER_COUNT];
+    int32_t worker_count;
+    
+    String pattern;
+    int32_t hot_dir_len;
+    
+    // Guards everything below
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    // Directories pushed, but not yet read
+    int32_t pending;
+    // Bumped whenever directories are pushed, so that idle workers know to
+    // look for them again
+    uint32_t generation;
+    int32_t idle_count;
+    // Directories left to read before tld_walk_run returns, leaving the rest
+    // for the next run
+    int32_t budget;
+};
+
+static bool32
+tld_walk_deque_push(tld_walk_deque *deque, tld_walk_dir *dirs, int32_t count) {
+    bool32 result = true;
+    pthread_mutex_lock(&deque->mutex);
+    
+    if (deque->capacity - deque->bottom < count && deque->top > 0) {
+        memmove(deque->dirs, deque->dirs + deque->top,
+                (deque->bottom - deque->top) * sizeof(tld_walk_dir));
+        deque->bottom -= deque->top;
+        deque->top = 0;
+    }
+    
+    if (deque->capacity - deque->bottom < count) {
+        int32_t capacity = max(max(2 * deque->capacity, deque->bottom + count), 256);
+        tld_walk_dir *new_dirs = (tld_walk_dir *) realloc(deque->dirs, capacity * sizeof(tld_walk_dir));
+        if (new_dirs) {
+            deque->dirs = new_dirs;
+            deque->capacity = capacity;
+        } else {
+            result = false;
+        }
+    }
+    
+    if (result) {
+        memcpy(deque->dirs + deque->bottom, dirs, count * sizeof(tld_walk_dir));
+        deque->bottom += count;
+    }
+    
+    pthread_mutex_unlock(&deque->mutex);
+    return result;
+}
+
+static bool32
+tld_walk_deque_take(tld_walk_deque *deque, tld_walk_dir *dir, bool32 steal) {
+    bool32 result = false;
+    pthread_mutex_lock(&deque->mutex);
+    
+    if (deque->top < deque->bottom) {
+        if (steal) {
+            *dir = deque->dirs[deque->top++];
+        } else {
+            *dir = deque->dirs[--deque->bottom];
+        }
+        result = true;
+    }
+    
+    pthread_mutex_unlock(&deque->mutex);
+    return result;
+}
+
+static void
+tld_walk_found_dir(tld_walk_worker *worker, tld_walk_dir dir, char *name, int32_t name_len) {
+    if (worker->found_count == worker->found_capacity) {
+        int32_t capacity = max(2 * worker->found_capacity, 64);
+        tld_walk_dir *found = (tld_walk_dir *) realloc(worker->found, capacity * sizeof(tld_walk_dir));
+        if (found == 0) return;
+        
+        worker->found = found;
+        worker->found_capacity = capacity;
+    }
+    
+    tld_walk_dir subdir;
+    subdir.size = dir.size + name_len + 1;
+    subdir.path = (char *) malloc(subdir.size + 1);
+    if (subdir.path == 0) return;
+    
+    memcpy(subdir.path, dir.path, dir.size);
+    memcpy(subdir.path + dir.size, name, name_len);
+    subdir.path[subdir.size - 1] = '/';
+    subdir.path[subdir.size] = 0;
+    
+    worker->found[worker->found_count++] = subdir;
+}
+
+// Matches the files in dir against the pattern and collects its subdirectories
+static void
+tld_walk_read_dir(tld_walk *walk, tld_walk_worker *worker, tld_walk_dir dir) {
+    int fd = open(dir.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    
+    String visible_dir = make_string(dir.path + walk->hot_dir_len, dir.size - walk->hot_dir_len);
+    
+    union {
+        uint64_t align;
+        char bytes[32 << 10];
+    } entries;
+    
+    while (true) {
+        long size = syscall(SYS_getdents64, fd, entries.bytes, sizeof(entries.bytes));
+        if (size <= 0) break;
+        
+        for (long offset = 0; offset < size;) {
+            // struct linux_dirent64, which glibc doesn't declare
+            char *entry = entries.bytes + offset;
+            uint16_t record_size = *(uint16_t *)(entry + 16);
+            uint8_t type = *(uint8_t *)(entry + 18);
+            char *name = entry + 19;
+            offset += record_size;
+            
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+            int32_t name_len = (int32_t) strlen(name);
+            
+            if (type == DT_UNKNOWN) {
+                struct stat info;
+                if (fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode)) {
+                    type = DT_DIR;
+                }
+            }
+            
+            if (type == DT_DIR) {
+                tld_walk_found_dir(worker, dir, name, name_len);
+            } else {
+                String file_name = make_string(name, name_len);
+                int32_t score = tld_fuzzy_match_ss(walk->pattern, file_name, &worker->scratch);
+                if (score) {
+                    tld_files_results_push(&worker->hits, visible_dir, file_name, score);
+                }
+            }
+        }
+    }
+    
+    close(fd);
+}
+
+static void
+tld_walk_job(void *data, int32_t index) {
+    tld_walk *walk = (tld_walk *) data;
+    tld_walk_worker *worker = &walk->workers[index];
+    
+    while (true) {
+        pthread_mutex_lock(&walk->mutex);
+        uint32_t generation = walk->generation;
+        bool32 out_of_budget = (walk->budget <= 0);
+        pthread_mutex_unlock(&walk->mutex);
+        
+        if (out_of_budget) break;
+        
+        tld_walk_dir dir;
+        bool32 found = tld_walk_deque_take(&worker->deque, &dir, false);
+        for (int32_t i = 1; !found && i < walk->worker_count; ++i) {
+            tld_walk_worker *victim = &walk->workers[(index + i) % walk->worker_count];
+            found = tld_walk_deque_take(&victim->deque, &dir, true);
+        }
+        
+        if (!found) {
+            pthread_mutex_lock(&walk->mutex);
+            if (walk->pending == 0 || walk->budget <= 0) {
+                pthread_mutex_unlock(&walk->mutex);
+                break;
+            }
+            
+            if (walk->generation == generation) {
+                walk->idle_count += 1;
+                pthread_cond_wait(&walk->work_available, &walk->mutex);
+                walk->idle_count -= 1;
+            }
+            pthread_mutex_unlock(&walk->mutex);
+            continue;
+        }
+        
+        worker->found_count = 0;
+        tld_walk_read_dir(walk, worker, dir);
+        free(dir.path);
+        
+        // Count the subdirectories before anyone can steal them, so that
+        // pending can't drop to zero while there is work left
+        pthread_mutex_lock(&walk->mutex);
+        walk->pending += worker->found_count;
+        walk->generation += 1;
+        pthread_mutex_unlock(&walk->mutex);
+        
+        if (worker->found_count &&
+            !tld_walk_deque_push(&worker->deque, worker->found, worker->found_count))
+        {
+            for (int32_t i = 0; i < worker->found_count; ++i) {
+                free(worker->found[i].path);
+            }
+            
+            pthread_mutex_lock(&walk->mutex);
+            walk->pending -= worker->found_count;
+            pthread_mutex_unlock(&walk->mutex);
+        }
+        
+        pthread_mutex_lock(&walk->mutex);
+        walk->pending -= 1;
+        walk->budget -= 1;
+        if (walk->idle_count && (worker->found_count || walk->pending == 0 || walk->budget <= 0)) {
+            pthread_cond_broadcast(&walk->work_available);
+        }
+        pthread_mutex_unlock(&walk->mutex);
+    }
+}
+
+static int32_t
+tld_milliseconds_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int32_t)((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+static int
+tld_walk_compare_hits(const void *a, const void *b) {
+    String *hit_a = (String *) a;
+    String *hit_b = (String *) b;
+    
+    int result = memcmp(hit_a->str, hit_b->str, min(hit_a->size, hit_b->size));
+    if (result == 0) result = hit_a->size - hit_b->size;
+    
+    return result;
+}
+
+// Prepares a walk of the tree below base_path, which collects the files that
+// match pattern. Returns 0 if out of memory.
+static tld_walk *
+tld_walk_begin(String base_path, String pattern) {
+    tld_walk *walk = (tld_walk *) calloc(1, sizeof(tld_walk));
+    if (walk == 0) return 0;
+    
+    walk->worker_count = min(tldui_worker_count(), TLDUI_MAX_WORKER_COUNT);
+    walk->pattern = pattern;
+    pthread_mutex_init(&walk->mutex, 0);
+    pthread_cond_init(&walk->work_available, 0);
+    for (int32_t i = 0; i < walk->worker_count; ++i) {
+        pthread_mutex_init(&walk->workers[i].deque.mutex, 0);
+    }
+    
+    tld_walk_dir root;
+    root.size = base_path.size;
+    root.path = (char *) malloc(root.size + 2);
+    if (root.path) {
+        memcpy(root.path, base_path.str, base_path.size);
+        if (root.size == 0 || root.path[root.size - 1] != '/') {
+            root.path[root.size++] = '/';
+        }
+        root.path[root.size] = 0;
+        walk->hot_dir_len = root.size;
+        
+        if (tld_walk_deque_push(&walk->workers[0].deque, &root, 1)) {
+            walk->pending = 1;
+        } else {
+            free(root.path);
+        }
+    }
+    
+    return walk;
+}
+
+// Reads up to budget more directories, or the rest of the tree. The hits are
+// added to the workers' hits. Returns whether the whole tree was walked.
+static bool32
+tld_walk_run(tld_walk *walk, int32_t budget) {
+    if (walk->pending) {
+        walk->budget = budget;
+        tldui_parallel_for(tld_walk_job, walk, walk->worker_count);
+    }
+    
+    return walk->pending == 0;
+}
+
+static void
+tld_walk_end(tld_walk *walk) {
+    for (int32_t i = 0; i < walk->worker_count; ++i) {
+        tld_walk_worker *worker = &walk->workers[i];
+        for (int32_t j = worker->deque.top; j < worker->deque.bottom; ++j) {
+            free(worker->deque.dirs[j].path);
+        }
+        
+        tld_files_results_free(&worker->hits);
+        tld_fuzzy_scratch_free(&worker->scratch);
+        free(worker->found);
+        free(worker->deque.dirs);
+        pthread_mutex_destroy(&worker->deque.mutex);
+    }
+    pthread_mutex_destroy(&walk->mutex);
+    pthread_cond_destroy(&walk->work_available);
+    free(walk);
+}
+
+// Adds the files below base_path that match pattern to the results
+static void
+tld_walk_search(String base_path, String pattern, tld_files_results *results) {
+    tld_walk *walk = tld_walk_begin(base_path, pattern);
+    if (walk == 0) return;
+    
+    tld_walk_run(walk, INT32_MAX);
+    for (int32_t i = 0; i < walk->worker_count; ++i) {
+        tld_files_results_merge(results, &walk->workers[i].hits);
+    }
+    
+    tld_walk_end(walk);
+}
+
+#else
+
+static void
+tld_print_search_results_recursive(Application_Links *app,
+                                   String base_path,
+                                   String pattern,
+                                   int32_t hot_dir_len,
+                                   tld_files_results *results,
+                                   tld_fuzzy_scratch *scratch)
+{
+    String base_path_visible = substr_tail(base_path, hot_dir_len);
+    
+    File_List contents = get_file_list(app, expand_str(base_path));
+    for (uint32_t i = 0; i < contents.count; ++i) {
+        if (contents.infos[i].folder) continue;
+        
+        String file_name = make_string(contents.infos[i].filename, contents.infos[i].filename_len);
+        int32_t score = tld_fuzzy_match_ss(pattern, file_name, scratch);
+        if (score) {
+            if (!tld_files_results_push(results, base_path_visible, file_name, score)) break;
+        }
+        
+    }
+    
+    for (uint32_t i = 0; i < contents.count; ++i) {
+        if (contents.infos[i].folder) {
+            int32_t old_size = base_path.size;
+            
+            if (base_path.memory_size - old_size > contents.infos[i].filename_len) {
+                append(&base_path,
+                       make_string(contents.infos[i].filename, contents.infos[i].filename_len));
+                append(&base_path, "/");
+                
+                tld_print_search_results_recursive(app, base_path, pattern, hot_dir_len,
+                                                   results, scratch);
+                
+                base_path.size = old_size;
+            }
+        }
+    }
+    
+    free_file_list(app, contents);
+}
+
+#endif
+
+// 
+// File Name Index
+// 
+
+// Recursive searches, and tld_project_open_file in 4tld_custom.cpp, look file
+// names up in an index of every file below one root directory instead of
+// walking the tree, see tld_files_index_root.
+// The index is built on a background thread and kept in a file named after
+// the root, in $XDG_CACHE_HOME/4tld/ or ~/.cache/4tld/, or next to the 4coder
+// executable if neither can be written to. The file is mapped into memory
+// when the root is indexed again, and only the directories whose mtime
+// changed since are read again then. While the editor runs, every indexed
+// directory is watched with inotify, and the directories that changed are
+// read again once no change was reported for TLDFM_FILE_INDEX_SETTLE
+// milliseconds.
+// Trees with more than TLDFM_FILE_INDEX_CAPACITY files, or more directories
+// than TLDFM_FILE_INDEX_WATCH_SHARE percent of the user's inotify watches
+// (fs.inotify.max_user_watches), aren't indexed, and are walked on every
+// search instead; the first such search says why in *messages*. The share
+// leaves watches for the directory cache and other programs. Set the capacity
+// to 0 to disable the index. Outside of Linux, and without threads, there is
+// no index.
+
+#ifndef TLDFM_FILE_INDEX_CAPACITY
+#define TLDFM_FILE_INDEX_CAPACITY (1 << 20)
+#endif
+
+#ifndef TLDFM_FILE_INDEX_SETTLE
+#define TLDFM_FILE_INDEX_SETTLE 100
+#endif
+
+#ifndef TLDFM_FILE_INDEX_WATCH_SHARE
+#define TLDFM_FILE_INDEX_WATCH_SHARE 25
+#endif
+
+#ifndef TLDFM_FILE_INDEX_PREFIX
+#define TLDFM_FILE_INDEX_PREFIX "4tld_file_index_"
+#endif
+
+#if defined(TLDFM_PARALLEL_WALK) && TLDFM_FILE_INDEX_CAPACITY > 0
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+
+// The index file, like the index in memory, is the header, followed by the
+// directories, the files, and the blob of names. The blob starts with the
+// root, followed by the paths of the directories, relative to the root and
+// with a trailing slash, and the names of the files. Files refer to their
+// directory and their name separately, so that every path is stored once.
+// Directories are in depth-first order, each one followed by its
+// subdirectories, sorted by name. Each directory's files are sorted by name,
+// and stored in the same order, so that the files below any directory are
+// stored back to back.
+// Bump the version whenever the layout changes.
+#define TLDFM_FILE_INDEX_MAGIC 0x49464454 // "TDFI"
+#define TLDFM_FILE_INDEX_VERSION 1
+
+struct tld_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t root_size;
+    uint32_t dir_count;
+    uint32_t file_count;
+    uint32_t blob_size;
+    uint32_t reserved;
+};
+
+struct tld_index_dir {
+    // st_mtim in nanoseconds, as of when the directory was read
+    uint64_t mtime;
+    uint32_t path;
+    uint32_t path_size;
+    // The directory's subdirectories are [this one + 1, end)
+    uint32_t end;
+    uint32_t first_file;
+    uint32_t file_count;
+    uint32_t reserved;
+};
+
+struct tld_index_file {
+    uint32_t dir;
+    uint32_t name;
+    uint32_t name_size;
+};
+
+struct tld_index_image {
+    tld_index_header *header;
+    tld_index_dir *dirs;
+    tld_index_file *files;
+    char *blob;
+    
+    void *memory;
+    uint32_t size;
+    bool32 mapped;
+    
+    // Guarded by the index mutex
+    int32_t refs;
+    uint32_t serial;
+};
+
+struct tld_files_index {
+    // The root, with a trailing slash
+    char *root;
+    int32_t root_size;
+    char *file_name;
+    
+    // Guarded by the mutex. The image is 0 until the index is ready, and
+    // again once the tree turned out to be too large to be indexed, which
+    // sets abandoned. paths holds the paths of the image's files, relative to
+    // the root, until tld_files_index_paths takes them; paths_serial is the
+    // serial of their image, or 0 if there are none.
+    pthread_mutex_t mutex;
+    tld_index_image *image;
+    char *abandoned; // Why the tree isn't indexed
+    tldui_fuzzy_corpus paths;
+    uint32_t paths_serial;
+    
+    // The number of directories the index may watch
+    int32_t watch_limit;
+    // Only touched by the UI thread
+    bool32 reported;
+    
+    pthread_t thread;
+    int wake_fd;
+    
+    // Only touched by the thread
+    int inotify_fd;
+    // The watch on each directory of the image, or -1
+    int *dir_watches;
+    // Whether each directory of the image changed since it was read
+    uint8_t *dirty;
+    // The directory of the image each watch descriptor is on, or -1
+    int32_t *watch_dirs;
+    int32_t watch_dirs_size;
+};
+
+static tld_files_index *tld_files_indexed = 0;
+static uint32_t tld_index_image_serials = 0;
+
+static inline uint64_t
+tld_index_mtime(struct stat *info) {
+    return (uint64_t) info->st_mtim.tv_sec * 1000000000ull + info->st_mtim.tv_nsec;
+}
+
+// Points the image at the index in memory, if it is one
+static bool32
+tld_index_image_init(tld_index_image *image, void *memory, uint32_t size) {
+    if (size < sizeof(tld_index_header)) return false;
+    
+    tld_index_header *header = (tld_index_header *) memory;
+    if (header->magic != TLDFM_FILE_INDEX_MAGIC || header->version != TLDFM_FILE_INDEX_VERSION) return false;
+    
+    uint64_t expected_size = sizeof(tld_index_header) + header->blob_size +
+        (uint64_t) header->dir_count * sizeof(tld_index_dir) +
+        (uint64_t) header->file_count * sizeof(tld_index_file);
+    if (header->size != size || expected_size != size) return false;
+    if (header->root_size > header->blob_size) return false;
+    
+    image->header = header;
+    image->dirs = (tld_index_dir *)(header + 1);
+    image->files = (tld_index_file *)(image->dirs + header->dir_count);
+    image->blob = (char *)(image->files + header->file_count);
+    image->memory = memory;
+    image->size = size;
+    
+    // Mapped files may have been written by anyone
+    for (uint32_t i = 0; i < header->dir_count; ++i) {
+        tld_index_dir *dir = &image->dirs[i];
+        if ((uint64_t) dir->path + dir->path_size > header->blob_size) return false;
+        if (dir->end <= i || dir->end > header->dir_count) return false;
+        if ((uint64_t) dir->first_file + dir->file_count > header->file_count) return false;
+        if (i > 0 && (dir->path_size == 0 || image->blob[dir->path + dir->path_size - 1] != '/')) return false;
+    }
+    
+    for (uint32_t i = 0; i < header->file_count; ++i) {
+        tld_index_file *file = &image->files[i];
+        if ((uint64_t) file->name + file->name_size > header->blob_size) return false;
+        if (file->dir >= header->dir_count) return false;
+    }
+    
+    return true;
+}
+
+static void
+tld_index_image_free(tld_index_image *image) {
+    if (image->mapped) {
+        munmap(image->memory, image->size);
+    } else {
+        free(image->memory);
+    }
+    free(image);
+}
+
+// The last component of a directory's path, without the trailing slash
+static inline String
+tld_index_dir_name(tld_index_image *image, uint32_t dir) {
+    String path = make_string(image->blob + image->dirs[dir].path, image->dirs[dir].path_size - 1);
+    
+    int32_t start = path.size;
+    while (start > 0 && path.str[start - 1] != '/') --start;
+    
+    return make_string(path.str + start, path.size - start);
+}
+
+static tld_index_image *
+tld_files_index_acquire(tld_files_index *index) {
+    pthread_mutex_lock(&index->mutex);
+    tld_index_image *image = index->image;
+    if (image) image->refs += 1;
+    pthread_mutex_unlock(&index->mutex);
+    
+    return image;
+}
+
+static void
+tld_files_index_release(tld_files_index *index, tld_index_image *image) {
+    pthread_mutex_lock(&index->mutex);
+    bool32 unused = (--image->refs == 0);
+    pthread_mutex_unlock(&index->mutex);
+    
+    if (unused) tld_index_image_free(image);
+}
+
+// Maps the index file, if it holds an index of the root
+static tld_index_image *
+tld_files_index_map(tld_files_index *index) {
+    if (index->file_name == 0) return 0;
+    
+    int fd = open(index->file_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    
+    struct stat info;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0 && info.st_size <= 0x7FFFFFFF) {
+        memory = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) return 0;
+    
+    tld_index_image *image = (tld_index_image *) calloc(1, sizeof(tld_index_image));
+    if (image == 0 || !tld_index_image_init(image, memory, (uint32_t) info.st_size) ||
+        image->header->root_size != (uint32_t) index->root_size ||
+        memcmp(image->blob, index->root, index->root_size) != 0)
+    {
+        munmap(memory, info.st_size);
+        free(image);
+        return 0;
+    }
+    
+    image->mapped = true;
+    image->refs = 1;
+    return image;
+}
+
+// Writes the image to the index file, and returns a mapping of the file in
+// its place. The file is written under another name and renamed, so that
+// mappings of the old file, in this or another instance of the editor, stay
+// intact.
+static tld_index_image *
+tld_files_index_save(tld_files_index *index, tld_index_image *image) {
+    if (index->file_name == 0) return image;
+    
+    int32_t name_size = (int32_t) strlen(index->file_name);
+    char *temp_name = (char *) malloc(name_size + 32);
+    if (temp_name == 0) return image;
+    snprintf(temp_name, name_size + 32, "%s.%d.tmp", index->file_name, (int) getpid());
+    
+    int fd = open(temp_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool32 written = (fd >= 0);
+    for (uint32_t done = 0; written && done < image->size;) {
+        ssize_t size = write(fd, (char *) image->memory + done, image->size - done);
+        if (size > 0) {
+            done += (uint32_t) size;
+        } else if (size == 0 || errno != EINTR) {
+            written = false;
+        }
+    }
+    
+    // Map the file we wrote, rather than whatever ends up under its name
+    void *memory = MAP_FAILED;
+    if (written) {
+        memory = mmap(0, image->size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) close(fd);
+    
+    if (!written || rename(temp_name, index->file_name) != 0) {
+        unlink(temp_name);
+    }
+    free(temp_name);
+    
+    if (memory != MAP_FAILED) {
+        free(image->memory);
+        tld_index_image_init(image, memory, image->size);
+        image->mapped = true;
+    }
+    
+    return image;
+}
+
+// The state of one update of the index, see tld_index_build_dir
+struct tld_index_build {
+    tld_files_index *index;
+    tld_index_image *old;
+    bool32 check_mtime;
+    bool32 failed;
+    char *failure; // Why it failed, if not for a lack of memory
+    
+    tld_index_dir *dirs;
+    int *watches; // The watch on each directory
+    int32_t dir_count;
+    int32_t dir_capacity;
+    
+    tld_index_file *files;
+    int32_t file_count;
+    int32_t file_capacity;
+    
+    char *blob;
+    uint32_t blob_size;
+    uint32_t blob_capacity;
+    
+    // The directory being built, starting with the root
+    char *path;
+    int32_t path_size;
+    int32_t path_capacity;
+    
+    char *entries;
+    int32_t entries_size;
+};
+
+static uint32_t
+tld_index_build_intern(tld_index_build *build, String text) {
+    if (build->blob_capacity - build->blob_size < (uint32_t) text.size) {
+        uint32_t capacity = max(2 * build->blob_capacity, build->blob_size + text.size);
+        capacity = max(capacity, 1 << 16);
+        char *blob = (char *) realloc(build->blob, capacity);
+        if (blob == 0) {
+            build->failed = true;
+            return 0;
+        }
+        
+        build->blob = blob;
+        build->blob_capacity = capacity;
+    }
+    
+    uint32_t offset = build->blob_size;
+    memcpy(build->blob + offset, text.str, text.size);
+    build->blob_size += text.size;
+    
+    return offset;
+}
+
+static int32_t
+tld_index_build_push_dir(tld_index_build *build) {
+    if (build->dir_count == build->dir_capacity) {
+        int32_t capacity = max(2 * build->dir_capacity, 256);
+        
+        tld_index_dir *dirs = (tld_index_dir *) realloc(build->dirs, capacity * sizeof(tld_index_dir));
+        if (dirs == 0) {
+            build->failed = true;
+            return -1;
+        }
+        build->dirs = dirs;
+        
+        int *watches = (int *) realloc(build->watches, capacity * sizeof(int));
+        if (watches == 0) {
+            build->failed = true;
+            return -1;
+        }
+        build->watches = watches;
+        
+        build->dir_capacity = capacity;
+    }
+    
+    int32_t dir = build->dir_count++;
+    memset(&build->dirs[dir], 0, sizeof(tld_index_dir));
+    build->watches[dir] = -1;
+    
+    return dir;
+}
+
+static void
+tld_index_build_push_file(tld_index_build *build, int32_t dir, String name) {
+    if (build->file_count >= TLDFM_FILE_INDEX_CAPACITY) {
+        build->failed = true;
+        build->failure = "it holds more files than TLDFM_FILE_INDEX_CAPACITY";
+        return;
+    }
+    
+    if (build->file_count == build->file_capacity) {
+        int32_t capacity = max(2 * build->file_capacity, 1024);
+        tld_index_file *files = (tld_index_file *) realloc(build->files, capacity * sizeof(tld_index_file));
+        if (files == 0) {
+            build->failed = true;
+            return;
+        }
+        
+        build->files = files;
+        build->file_capacity = capacity;
+    }
+    
+    tld_index_file *file = &build->files[build->file_count++];
+    file->dir = dir;
+    file->name = tld_index_build_intern(build, name);
+    file->name_size = name.size;
+}
+
+// Appends a subdirectory to the path
+static bool32
+tld_index_build_enter(tld_index_build *build, String name) {
+    int32_t size = build->path_size + name.size + 1;
+    if (size + 1 > build->path_capacity) {
+        int32_t capacity = max(2 * build->path_capacity, size + 1);
+        char *path = (char *) realloc(build->path, capacity);
+        if (path == 0) {
+            build->failed = true;
+            return false;
+        }
+        
+        build->path = path;
+        build->path_capacity = capacity;
+    }
+    
+    memcpy(build->path + build->path_size, name.str, name.size);
+    build->path[size - 1] = '/';
+    build->path[size] = 0;
+    build->path_size = size;
+    
+    return true;
+}
+
+static inline void
+tld_index_build_leave(tld_index_build *build, int32_t path_size) {
+    build->path_size = path_size;
+    build->path[path_size] = 0;
+}
+
+// Reads the names of the files and subdirectories of the directory at the
+// path. Returns false if it can't be read.
+static bool32
+tld_index_read_dir(tld_index_build *build, tld_file_manager_state *files,
+                   tld_file_manager_state *subdirs, uint64_t *mtime)
+{
+    int fd = open(build->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    
+    // Changes made while the directory is read give it a newer mtime
+    struct stat info;
+    bool32 result = (fstat(fd, &info) == 0);
+    *mtime = tld_index_mtime(&info);
+    
+    while (result) {
+        long size = syscall(SYS_getdents64, fd, build->entries, build->entries_size);
+        if (size < 0) result = false;
+        if (size <= 0) break;
+        
+        for (long offset = 0; offset < size;) {
+            // struct linux_dirent64, see tld_walk_read_dir
+            char *entry = build->entries + offset;
+            uint16_t record_size = *(uint16_t *)(entry + 16);
+            uint8_t type = *(uint8_t *)(entry + 18);
+            char *name = entry + 19;
+            offset += record_size;
+            
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+            
+            if (type == DT_UNKNOWN) {
+                if (fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode)) {
+                    type = DT_DIR;
+                }
+            }
+            
+            tld_file_manager_state *dest = (type == DT_DIR) ? subdirs : files;
+            if (!tld_files_push_entry(dest, {0}, make_string(name, (int32_t) strlen(name)))) {
+                build->failed = true;
+                result = false;
+                break;
+            }
+        }
+    }
+    
+    close(fd);
+    return result;
+}
+
+// The names of the entries in state, sorted
+static String *
+tld_index_sorted_names(tld_file_manager_state *state) {
+    String *names = (String *) malloc(max(state->entry_count, 1) * sizeof(String));
+    if (names == 0) return 0;
+    
+    for (int32_t i = 0; i < state->entry_count; ++i) {
+        names[i] = tld_files_entry_name(state, i);
+    }
+    qsort(names, state->entry_count, sizeof(String), tld_walk_compare_hits);
+    
+    return names;
+}
+
+// Adds the directory at the path, and everything below it, to the index.
+// old_dir is the same directory in the old index, or -1 if it wasn't indexed.
+// Directories that weren't indexed, changed according to inotify, or, if
+// build->check_mtime is set, have a different mtime now, are read again,
+// everything else is copied from the old index.
+static void
+tld_index_build_dir(tld_index_build *build, int32_t old_dir) {
+    if (build->failed) return;
+    
+    tld_files_index *index = build->index;
+    tld_index_image *old = build->old;
+    
+    if (build->dir_count >= index->watch_limit) {
+        build->failed = true;
+        build->failure = "it has more directories than TLDFM_FILE_INDEX_WATCH_SHARE lets it watch";
+        return;
+    }
+    
+    int32_t dir = tld_index_build_push_dir(build);
+    if (dir < 0) return;
+    
+    String path = make_string(build->path + index->root_size, build->path_size - index->root_size);
+    build->dirs[dir].path = tld_index_build_intern(build, path);
+    build->dirs[dir].path_size = path.size;
+    build->dirs[dir].first_file = build->file_count;
+    
+    // Watch the directory before reading it, so that no change goes unnoticed
+    int watch = (old_dir >= 0) ? index->dir_watches[old_dir] : -1;
+    bool32 new_watch = (watch < 0);
+    if (new_watch) {
+        uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+        watch = inotify_add_watch(index->inotify_fd, build->path, mask);
+        if (watch < 0) {
+            // Without a watch, the index can't be kept up to date
+            if (errno == ENOSPC || errno == ENOMEM) {
+                build->failed = true;
+                build->failure = "the user is out of inotify watches";
+            }
+            build->dir_count -= 1;
+            return;
+        }
+    }
+    build->watches[dir] = watch;
+    
+    bool32 read_again = (old_dir < 0 || index->dirty[old_dir]);
+    if (!read_again && build->check_mtime) {
+        struct stat info;
+        read_again = (stat(build->path, &info) != 0 ||
+                      tld_index_mtime(&info) != old->dirs[old_dir].mtime);
+    }
+    
+    if (!read_again) {
+        tld_index_dir *source = &old->dirs[old_dir];
+        build->dirs[dir].mtime = source->mtime;
+        
+        for (uint32_t i = 0; i < source->file_count; ++i) {
+            tld_index_file *file = &old->files[source->first_file + i];
+            tld_index_build_push_file(build, dir, make_string(old->blob + file->name, file->name_size));
+        }
+        build->dirs[dir].file_count = build->file_count - build->dirs[dir].first_file;
+        
+        for (uint32_t child = old_dir + 1; child < source->end; child = old->dirs[child].end) {
+            int32_t path_size = build->path_size;
+            if (!tld_index_build_enter(build, tld_index_dir_name(old, child))) break;
+            tld_index_build_dir(build, child);
+            tld_index_build_leave(build, path_size);
+        }
+    } else {
+        tld_file_manager_state files = {0};
+        tld_file_manager_state subdirs = {0};
+        uint64_t mtime = 0;
+        
+        String *file_names = 0;
+        String *subdir_names = 0;
+        if (tld_index_read_dir(build, &files, &subdirs, &mtime)) {
+            file_names = tld_index_sorted_names(&files);
+            subdir_names = tld_index_sorted_names(&subdirs);
+        }
+        
+        if (file_names == 0 || subdir_names == 0) {
+            // Gone, or not readable
+            if (new_watch) inotify_rm_watch(index->inotify_fd, watch);
+            build->dir_count -= 1;
+        } else {
+            build->dirs[dir].mtime = mtime;
+            for (int32_t i = 0; i < files.entry_count; ++i) {
+                tld_index_build_push_file(build, dir, file_names[i]);
+            }
+            build->dirs[dir].file_count = build->file_count - build->dirs[dir].first_file;
+            
+            // Both lists are sorted by name, so matching subdirectories up
+            // takes one pass over each
+            uint32_t child = old_dir + 1;
+            uint32_t children_end = (old_dir >= 0) ? old->dirs[old_dir].end : 0;
+            for (int32_t i = 0; i < subdirs.entry_count; ++i) {
+                int32_t old_child = -1;
+                while (child < children_end) {
+                    String old_name = tld_index_dir_name(old, child);
+                    int order = tld_walk_compare_hits(&old_name, &subdir_names[i]);
+                    if (order > 0) break;
+                    
+                    if (order == 0) old_child = child;
+                    child = old->dirs[child].end;
+                    if (order == 0) break;
+                }
+                
+                int32_t path_size = build->path_size;
+                if (!tld_index_build_enter(build, subdir_names[i])) break;
+                tld_index_build_dir(build, old_child);
+                tld_index_build_leave(build, path_size);
+            }
+        }
+        
+        free(file_names);
+        free(subdir_names);
+        tld_files_state_free(&files);
+        tld_files_state_free(&subdirs);
+    }
+    
+    if (dir < build->dir_count) {
+        build->dirs[dir].end = build->dir_count;
+    }
+}
+
+static tld_index_image *
+tld_index_build_image(tld_index_build *build) {
+    uint64_t size = sizeof(tld_index_header) + build->blob_size +
+        (uint64_t) build->dir_count * sizeof(tld_index_dir) +
+        (uint64_t) build->file_count * sizeof(tld_index_file);
+    if (size > 0x7FFFFFFF) return 0;
+    
+    char *memory = (char *) malloc(size);
+    tld_index_image *image = (tld_index_image *) calloc(1, sizeof(tld_index_image));
+    if (memory == 0 || image == 0) {
+        free(memory);
+        free(image);
+        return 0;
+    }
+    
+    tld_index_header *header = (tld_index_header *) memory;
+    memset(header, 0, sizeof(tld_index_header));
+    header->magic = TLDFM_FILE_INDEX_MAGIC;
+    header->version = TLDFM_FILE_INDEX_VERSION;
+    header->size = (uint32_t) size;
+    header->root_size = build->index->root_size;
+    header->dir_count = build->dir_count;
+    header->file_count = build->file_count;
+    header->blob_size = build->blob_size;
+    
+    char *at = memory + sizeof(tld_index_header);
+    memcpy(at, build->dirs, build->dir_count * sizeof(tld_index_dir));
+    at += build->dir_count * sizeof(tld_index_dir);
+    memcpy(at, build->files, build->file_count * sizeof(tld_index_file));
+    at += build->file_count * sizeof(tld_index_file);
+    memcpy(at, build->blob, build->blob_size);
+    
+    tld_index_image_init(image, memory, (uint32_t) size);
+    image->refs = 1;
+    return image;
+}
+
+// Moves the watches over to the new image's directories, and stops watching
+// the directories that are no longer indexed
+static bool32
+tld_files_index_rewatch(tld_files_index *index, tld_index_build *build) {
+    int32_t watch_dirs_size = 1;
+    for (int32_t i = 0; i < build->dir_count; ++i) {
+        watch_dirs_size = max(watch_dirs_size, build->watches[i] + 1);
+    }
+    
+    int32_t *watch_dirs = (int32_t *) malloc(watch_dirs_size * sizeof(int32_t));
+    uint8_t *dirty = (uint8_t *) calloc(max(build->dir_count, 1), 1);
+    if (watch_dirs == 0 || dirty == 0) {
+        free(watch_dirs);
+        free(dirty);
+        return false;
+    }
+    
+    memset(watch_dirs, 0xFF, watch_dirs_size * sizeof(int32_t));
+    for (int32_t i = 0; i < build->dir_count; ++i) {
+        watch_dirs[build->watches[i]] = i;
+    }
+    
+    if (build->old) {
+        for (uint32_t i = 0; i < build->old->header->dir_count; ++i) {
+            int watch = index->dir_watches[i];
+            if (watch >= 0 && (watch >= watch_dirs_size || watch_dirs[watch] < 0)) {
+                inotify_rm_watch(index->inotify_fd, watch);
+            }
+        }
+    }
+    
+    free(index->dir_watches);
+    free(index->dirty);
+    free(index->watch_dirs);
+    
+    index->dir_watches = build->watches;
+    index->dirty = dirty;
+    index->watch_dirs = watch_dirs;
+    index->watch_dirs_size = watch_dirs_size;
+    build->watches = 0;
+    
+    return true;
+}
+
+// Fills the corpus with the paths of the image's files, relative to the root
+static bool32
+tld_index_image_paths(tld_index_image *image, tldui_fuzzy_corpus *corpus) {
+    char path_space[4096];
+    for (uint32_t i = 0; i < image->header->file_count; ++i) {
+        tld_index_file *file = &image->files[i];
+        tld_index_dir *dir = &image->dirs[file->dir];
+        if (dir->path_size + file->name_size > sizeof(path_space)) continue;
+        
+        memcpy(path_space, image->blob + dir->path, dir->path_size);
+        memcpy(path_space + dir->path_size, image->blob + file->name, file->name_size);
+        if (!tldui_fuzzy_corpus_push(corpus, make_string(path_space, dir->path_size + file->name_size))) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Publishes the image along with the paths of its files, if there are any
+static void
+tld_files_index_publish(tld_files_index *index, tld_index_image *image, tldui_fuzzy_corpus *paths) {
+    pthread_mutex_lock(&index->mutex);
+    tld_index_image *old = index->image;
+    index->image = image;
+    if (image) image->serial = ++tld_index_image_serials;
+    
+    tldui_fuzzy_corpus old_paths = index->paths;
+    if (image && paths) {
+        index->paths = *paths;
+        index->paths_serial = image->serial;
+    } else {
+        index->paths = {0};
+        index->paths_serial = 0;
+    }
+    pthread_mutex_unlock(&index->mutex);
+    
+    if (old) tld_files_index_release(index, old);
+    tldui_fuzzy_corpus_free(&old_paths);
+}
+
+// Builds a new image from the old one, which may be 0, and publishes it.
+// Returns false, and publishes no image at all, if the tree can't be indexed.
+static bool32
+tld_files_index_update(tld_files_index *index, tld_index_image *old, bool32 check_mtime) {
+    tld_index_build build = {0};
+    build.index = index;
+    build.old = (old && old->header->dir_count) ? old : 0;
+    build.check_mtime = check_mtime;
+    build.entries_size = 32 << 10;
+    build.entries = (char *) malloc(build.entries_size);
+    build.failed = (build.entries == 0);
+    
+    build.path_capacity = index->root_size + 256;
+    build.path = (char *) malloc(build.path_capacity);
+    if (build.path) {
+        memcpy(build.path, index->root, index->root_size + 1);
+        build.path_size = index->root_size;
+    } else {
+        build.failed = true;
+    }
+    
+    tld_index_build_intern(&build, make_string(index->root, index->root_size));
+    tld_index_build_dir(&build, build.old ? 0 : -1);
+    
+    tld_index_image *image = 0;
+    if (!build.failed) {
+        image = tld_index_build_image(&build);
+    }
+    if (image && !tld_files_index_rewatch(index, &build)) {
+        tld_index_image_free(image);
+        image = 0;
+    }
+    if (image) {
+        image = tld_files_index_save(index, image);
+    }
+    
+    tldui_fuzzy_corpus paths = {0};
+    bool32 listed = (image && tld_index_image_paths(image, &paths));
+    if (!listed) tldui_fuzzy_corpus_free(&paths);
+    
+    if (image == 0) {
+        pthread_mutex_lock(&index->mutex);
+        index->abandoned = build.failure ? build.failure : (char *) "out of memory";
+        pthread_mutex_unlock(&index->mutex);
+    }
+    
+    // The old image may be the published one, so it has to go last
+    tld_files_index_publish(index, image, listed ? &paths : 0);
+    
+    free(build.dirs);
+    free(build.watches);
+    free(build.files);
+    free(build.blob);
+    free(build.path);
+    free(build.entries);
+    
+    return image != 0;
+}
+
+// Marks the directories that changed as dirty. Returns whether any did.
+static bool32
+tld_files_index_read_events(tld_files_index *index, bool32 *check_mtime) {
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } events;
+    
+    ssize_t size = read(index->inotify_fd, events.bytes, sizeof(events.bytes));
+    if (size <= 0) return false;
+    
+    for (char *at = events.bytes; at < events.bytes + size;) {
+        struct inotify_event *event = (struct inotify_event *) at;
+        at += sizeof(struct inotify_event) + event->len;
+        
+        if (event->mask & IN_Q_OVERFLOW) {
+            // Changes were lost, so every directory has to be checked
+            *check_mtime = true;
+        } else if (event->wd >= 0 && event->wd < index->watch_dirs_size) {
+            int32_t dir = index->watch_dirs[event->wd];
+            if (dir < 0) continue;
+            
+            index->dirty[dir] = 1;
+            if (event->mask & IN_IGNORED) {
+                // The kernel removed the watch already
+                index->dir_watches[dir] = -1;
+                index->watch_dirs[event->wd] = -1;
+            }
+        }
+    }
+    
+    return true;
+}
+
+static void *
+tld_files_index_thread_main(void *param) {
+    tld_files_index *index = (tld_files_index *) param;
+    
+    // The index of the last session is only a starting point, it isn't
+    // published before every directory in it was checked
+    tld_index_image *loaded = tld_files_index_map(index);
+    if (loaded) {
+        uint32_t dir_count = loaded->header->dir_count;
+        index->dir_watches = (int *) malloc(max(dir_count, 1) * sizeof(int));
+        index->dirty = (uint8_t *) calloc(max(dir_count, 1), 1);
+        
+        if (index->dir_watches && index->dirty) {
+            memset(index->dir_watches, 0xFF, dir_count * sizeof(int));
+        } else {
+            tld_index_image_free(loaded);
+            loaded = 0;
+        }
+    }
+    
+    bool32 indexed = tld_files_index_update(index, loaded, true);
+    if (loaded) tld_index_image_free(loaded);
+    
+    struct pollfd fds[2] = {{index->inotify_fd, POLLIN, 0}, {index->wake_fd, POLLIN, 0}};
+    bool32 changed = false;
+    bool32 check_mtime = false;
+    struct timespec first_change = {0};
+    
+    while (indexed) {
+        int ready = poll(fds, 2, changed ? TLDFM_FILE_INDEX_SETTLE : -1);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0 || fds[1].revents) break;
+        
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            if (!changed) clock_gettime(CLOCK_MONOTONIC, &first_change);
+            changed = tld_files_index_read_events(index, &check_mtime) || changed;
+        }
+        
+        // A steady stream of changes only delays the update so long
+        if (changed && (ready == 0 ||
+                        tld_milliseconds_since(&first_change) >= 10 * TLDFM_FILE_INDEX_SETTLE))
+        {
+            indexed = tld_files_index_update(index, index->image, check_mtime);
+            changed = false;
+            check_mtime = false;
+        }
+    }
+    
+    if (!indexed) {
+        // Give the watches back
+        close(index->inotify_fd);
+        index->inotify_fd = -1;
+    }
+    
+    return 0;
+}
+
+static void
+tld_files_index_stop(tld_files_index *index) {
+    eventfd_write(index->wake_fd, 1);
+    pthread_join(index->thread, 0);
+    
+    if (index->image) tld_files_index_release(index, index->image);
+    tldui_fuzzy_corpus_free(&index->paths);
+    if (index->inotify_fd >= 0) close(index->inotify_fd);
+    close(index->wake_fd);
+    pthread_mutex_destroy(&index->mutex);
+    
+    free(index->dir_watches);
+    free(index->dirty);
+    free(index->watch_dirs);
+    free(index->root);
+    free(index->file_name);
+    free(index);
+}
+
+// Puts the directory index files are kept in into dir
+static void
+tld_files_index_directory(Application_Links *app, String *dir) {
+    char *cache_home = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    
+    dir->size = 0;
+    bool32 fits = true;
+    if (cache_home && cache_home[0] == '/') {
+        fits = append_sc(dir, cache_home);
+    } else if (home && home[0] == '/') {
+        fits = append_sc(dir, home) && append_sc(dir, "/.cache");
+    }
+    
+    if (dir->size > 0 && fits && terminate_with_null(dir)) {
+        mkdir(dir->str, 0700);
+        if (append_sc(dir, "/4tld") && terminate_with_null(dir)) {
+            mkdir(dir->str, 0700);
+            if (access(dir->str, W_OK) == 0) return;
+        }
+    }
+    
+    dir->size = get_4ed_path(app, dir->str, dir->memory_size);
+}
+
+// The number of directories the index may watch
+static int32_t
+tld_files_index_watch_limit() {
+    long max_watches = 8192;
+    
+    FILE *file = fopen("/proc/sys/fs/inotify/max_user_watches", "r");
+    if (file) {
+        long value;
+        if (fscanf(file, "%ld", &value) == 1 && value > 0) max_watches = value;
+        fclose(file);
+    }
+    
+    return (int32_t) min(max_watches / 100 * TLDFM_FILE_INDEX_WATCH_SHARE, 0x7FFFFFFFL);
+}
+
+// Starts indexing the files below root, unless they already are, and stops
+// indexing whatever was indexed before. The index is ready once it's built,
+// or, if it was kept from an earlier session, checked.
+static void
+tld_files_index_root(Application_Links *app, String root) {
+    while (root.size > 1 && root.str[root.size - 1] == '/' && root.str[root.size - 2] == '/') {
+        root.size -= 1;
+    }
+    if (root.size == 0) return;
+    
+    bool32 slash = (root.str[root.size - 1] == '/');
+    tld_files_index *current = tld_files_indexed;
+    if (current && current->root_size == root.size + !slash &&
+        memcmp(current->root, root.str, root.size) == 0)
+    {
+        return;
+    }
+    
+    if (current) {
+        tld_files_index_stop(current);
+        tld_files_indexed = 0;
+    }
+    
+    tld_files_index *index = (tld_files_index *) calloc(1, sizeof(tld_files_index));
+    if (index == 0) return;
+    
+    index->root = (char *) malloc(root.size + 2);
+    if (index->root == 0) {
+        free(index);
+        return;
+    }
+    memcpy(index->root, root.str, root.size);
+    index->root_size = root.size;
+    if (!slash) index->root[index->root_size++] = '/';
+    index->root[index->root_size] = 0;
+    
+    // Indexes of different roots go into different files
+    uint32_t hash = 2166136261u;
+    for (int32_t i = 0; i < index->root_size; ++i) {
+        hash = (hash ^ (uint8_t) index->root[i]) * 16777619u;
+    }
+    
+    char file_name_space[1024];
+    String file_name = make_fixed_width_string(file_name_space);
+    tld_files_index_directory(app, &file_name);
+    if (file_name.size > 0 && file_name.size < file_name.memory_size - 64) {
+        char hash_space[16];
+        snprintf(hash_space, sizeof(hash_space), "%08x.bin", hash);
+        
+        append_sc(&file_name, "/");
+        append_sc(&file_name, TLDFM_FILE_INDEX_PREFIX);
+        append_sc(&file_name, hash_space);
+        if (terminate_with_null(&file_name)) {
+            index->file_name = (char *) malloc(file_name.size + 1);
+            if (index->file_name) memcpy(index->file_name, file_name.str, file_name.size + 1);
+        }
+    }
+    
+    index->watch_limit = tld_files_index_watch_limit();
+    index->inotify_fd = inotify_init1(IN_CLOEXEC);
+    index->wake_fd = eventfd(0, EFD_CLOEXEC);
+    pthread_mutex_init(&index->mutex, 0);
+    
+    if (index->inotify_fd >= 0 && index->wake_fd >= 0 &&
+        pthread_create(&index->thread, 0, tld_files_index_thread_main, index) == 0)
+    {
+        tld_files_indexed = index;
+        return;
+    }
+    
+    if (index->inotify_fd >= 0) close(index->inotify_fd);
+    if (index->wake_fd >= 0) close(index->wake_fd);
+    pthread_mutex_destroy(&index->mutex);
+    free(index->root);
+    free(index->file_name);
+    free(index);
+}
+
+// The indexed directory at the path, or -1 if it isn't indexed
+static int32_t
+tld_files_index_find_dir(tld_files_index *index, tld_index_image *image, String path) {
+    while (path.size > 0 && path.str[path.size - 1] == '/') path.size -= 1;
+    if (path.size + 1 < index->root_size ||
+        memcmp(path.str, index->root, index->root_size - 1) != 0)
+    {
+        return -1;
+    }
+    if (path.size < index->root_size) return image->header->dir_count ? 0 : -1;
+    if (path.str[index->root_size - 1] != '/') return -1;
+    
+    String relative = make_string(path.str + index->root_size, path.size - index->root_size);
+    for (uint32_t i = 1; i < image->header->dir_count; ++i) {
+        tld_index_dir *dir = &image->dirs[i];
+        if (dir->path_size == (uint32_t) relative.size + 1 &&
+            memcmp(image->blob + dir->path, relative.str, relative.size) == 0)
+        {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+struct tld_index_search_job {
+    tld_index_image *image;
+    String pattern;
+    // The length of the searched directory's relative path, which the
+    // results are relative to
+    uint32_t base_size;
+    uint32_t first_file;
+    uint32_t end_file;
+    
+    tld_fuzzy_scratch scratch;
+    tld_files_results hits;
+};
+
+static void
+tld_index_search_proc(void *data, int32_t index) {
+    tld_index_search_job *job = (tld_index_search_job *) data + index;
+    tld_index_image *image = job->image;
+    
+    for (uint32_t i = job->first_file; i < job->end_file; ++i) {
+        tld_index_file *file = &image->files[i];
+        String name = make_string(image->blob + file->name, file->name_size);
+        
+        int32_t score = tld_fuzzy_match_ss(job->pattern, name, &job->scratch);
+        if (score) {
+            tld_index_dir *dir = &image->dirs[file->dir];
+            String dir_path = make_string(image->blob + dir->path + job->base_size,
+                                          dir->path_size - job->base_size);
+            if (!tld_files_results_push(&job->hits, dir_path, name, score)) break;
+        }
+    }
+}
+
+// Adds the indexed files below dir that match pattern to the results, in
+// order of their paths. Returns false if the index isn't ready, or doesn't
+// cover dir.
+static bool32
+tld_files_index_search(String dir, String pattern, tld_files_results *results) {
+    tld_files_index *index = tld_files_indexed;
+    if (index == 0) return false;
+    
+    tld_index_image *image = tld_files_index_acquire(index);
+    if (image == 0) return false;
+    
+    int32_t base = tld_files_index_find_dir(index, image, dir);
+    if (base < 0) {
+        tld_files_index_release(index, image);
+        return false;
+    }
+    
+    // The files below a directory are stored back to back
+    tld_index_dir *last = &image->dirs[image->dirs[base].end - 1];
+    uint32_t first_file = image->dirs[base].first_file;
+    uint32_t file_count = last->first_file + last->file_count - first_file;
+    
+    int32_t job_count = 1;
+    if (file_count >= TLDUI_PARALLEL_THRESHOLD) {
+        job_count = min(tldui_worker_count(), TLDUI_MAX_WORKER_COUNT);
+    }
+    
+    tld_index_search_job jobs[TLDUI_MAX_WORKER_COUNT];
+    memset(jobs, 0, sizeof(jobs));
+    for (int32_t i = 0; i < job_count; ++i) {
+        jobs[i].image = image;
+        jobs[i].pattern = pattern;
+        jobs[i].base_size = image->dirs[base].path_size;
+        jobs[i].first_file = first_file + (uint32_t)((uint64_t) file_count * i / job_count);
+        jobs[i].end_file = first_file + (uint32_t)((uint64_t) file_count * (i + 1) / job_count);
+    }
+    tldui_parallel_for(tld_index_search_proc, jobs, job_count);
+    
+    // Each job searched a range of files, so their hits stay in order
+    for (int32_t i = 0; i < job_count; ++i) {
+        tld_files_results_merge(results, &jobs[i].hits);
+        tld_fuzzy_scratch_free(&jobs[i].scratch);
+    }
+    tld_files_index_release(index, image);
+    
+    return true;
+}
+
+// Moves the paths of all indexed files, relative to root, into the corpus,
+// unless it holds them already. They are listed on the index's thread, along
+// with every update of the index. *serial identifies the index the corpus was
+// filled from, start it out as 0. Returns false if the index of root isn't
+// ready.
+static bool32
+tld_files_index_paths(String root, tldui_fuzzy_corpus *corpus, uint32_t *serial) {
+    tld_files_index *index = tld_files_indexed;
+    if (index == 0) return false;
+    
+    tld_index_image *image = tld_files_index_acquire(index);
+    if (image == 0) return false;
+    
+    bool32 covered = (tld_files_index_find_dir(index, image, root) == 0);
+    tld_files_index_release(index, image);
+    if (!covered) return false;
+    
+    tldui_fuzzy_corpus old = {0};
+    pthread_mutex_lock(&index->mutex);
+    if (index->paths_serial != 0 && index->paths_serial != *serial) {
+        old = *corpus;
+        *corpus = index->paths;
+        *serial = index->paths_serial;
+        index->paths = {0};
+        index->paths_serial = 0;
+    }
+    pthread_mutex_unlock(&index->mutex);
+    tldui_fuzzy_corpus_free(&old);
+    
+    return *serial != 0;
+}
 
-char tld_files_dir_header[] =
-"\n===[ Directories ]=========================================================================\n";
-char tld_files_divider[] = "\n===[ Files ]===============================================================================\n";
+// Says in *messages* why the tree isn't indexed, the first time it's asked
+static void
+tld_files_index_report(Application_Links *app) {
+    tld_files_index *index = tld_files_indexed;
+    if (index == 0 || index->reported) return;
+    
+    pthread_mutex_lock(&index->mutex);
+    char *reason = index->abandoned;
+    pthread_mutex_unlock(&index->mutex);
+    if (reason == 0) return;
+    
+    index->reported = true;
+    
+    char message_space[1024];
+    String message = make_fixed_width_string(message_space);
+    append_sc(&message, "Not indexing ");
+    append_ss(&message, make_string(index->root, index->root_size));
+    append_sc(&message, ", because ");
+    append_sc(&message, reason);
+    append_sc(&message, "\n");
+    print_message(app, expand_str(message));
+}
 
-static tld_file_manager_state
-tld_print_directory(Application_Links *app,
-                    Buffer_Summary *buffer,
-                    String dir, String needle_file)
-{
-    tld_file_manager_state new_state = {0};
+// Whether the index is still being built
+static bool32
+tld_files_index_pending() {
+    tld_files_index *index = tld_files_indexed;
+    if (index == 0) return false;
     
-    buffer_replace_range(app, buffer, 0, buffer->size, expand_str(dir));
-    buffer_replace_range(app, buffer, buffer->size, buffer->size, literal(tld_files_dir_header));
-    tldui_table_printer printer = tldui_make_table(buffer, 30, 3);
+    pthread_mutex_lock(&index->mutex);
+    bool32 pending = (index->image == 0 && !index->abandoned);
+    pthread_mutex_unlock(&index->mutex);
     
-    File_List contents = get_file_list(app, expand_str(dir));
-    new_state.entry_count = contents.count;
-    new_state.cells = (Range *) malloc(contents.count * sizeof(Range));
-    if (new_state.cells == 0) return new_state;
+    return pending;
+}
+
+#else
+
+static inline void tld_files_index_root(Application_Links *app, String root) {}
+static inline bool32 tld_files_index_search(String dir, String pattern, tld_files_results *results) { return false; }
+static inline bool32 tld_files_index_paths(String root, tldui_fuzzy_corpus *corpus, uint32_t *serial) { return false; }
+static inline bool32 tld_files_index_pending() { return false; }
+static inline void tld_files_index_report(Application_Links *app) {}
+
+#endif
+
+// Adds the files below base_path that match pattern to the results by
+// walking the tree
+static void
+tld_files_walk(Application_Links *app, String base_path, String pattern,
+               tld_files_results *results)
+{
+    tld_files_index_report(app);
+    
+#ifdef TLDFM_PARALLEL_WALK
+    tld_walk_search(base_path, pattern, results);
+#else
+    tld_fuzzy_scratch scratch = {0};
+    tld_print_search_results_recursive(app, base_path, pattern, base_path.size,
+                                       results, &scratch);
+    tld_fuzzy_scratch_free(&scratch);
+#endif
+}
+
+char tld_files_search_header[] =
+"\n===[ Search Results ]======================================================================\n";
+
+// Shows the best search results in state->results
+static void
+tld_files_print_results(Application_Links *app,
+                        Buffer_Summary *buffer,
+                        String base_path,
+                        tld_file_manager_state *state)
+{
+    tld_files_results_show(&state->results, state, TLDFM_SEARCH_RESULT_STEP);
+    if (!tld_files_layout(state)) {
+        tld_files_state_free(state);
+        return;
+    }
     
-    Range * next_cell = new_state.cells;
+    tld_files_print(app, buffer, state, base_path, literal(tld_files_search_header));
+}
+
+static void
+tld_print_search_results(Application_Links *app,
+                         Buffer_Summary *buffer,
+                         String base_path,
+                         String pattern,
+                         tld_file_manager_state *state)
+{
+    tld_files_state_free(state);
+    state->showing_search_results = true;
     
-    for (uint32_t i = 0; i < contents.count; ++i) {
-        String file_name = make_string(contents.infos[i].filename, contents.infos[i].filename_len);
-        if (contents.infos[i].folder) {
-            if (needle_file.str && match_ss(file_name, needle_file)) {
-                new_state.selected_index = (int32_t)(next_cell - new_state.cells);
-            }
-            
-            new_state.directory_count += 1;
-            *next_cell++ = tldui_print_table_cell(app, &printer, file_name);
-        }
+    if (!tld_files_index_search(base_path, pattern, &state->results)) {
+        tld_files_walk(app, base_path, pattern, &state->results);
     }
     
-    buffer_replace_range(app, buffer, buffer->size, buffer->size, literal(tld_files_divider));
-    printer.current_column = 0;
+    tld_files_print_results(app, buffer, base_path, state);
+}
+
+// Shows the next TLDFM_SEARCH_RESULT_STEP search results once the last one
+// shown is selected
+static void
+tld_files_show_more_results(Application_Links *app, View_Summary *view,
+                            tld_file_manager_state *state)
+{
+    if (!state->showing_search_results ||
+        state->selected_index + 1 < state->entry_count ||
+        state->entry_count >= state->results.hit_count)
+    {
+        return;
+    }
     
-    for (uint32_t i = 0; i < contents.count; ++i) {
-        String file_name = make_string(contents.infos[i].filename, contents.infos[i].filename_len);
-        if (!contents.infos[i].folder) {
-            if (needle_file.str && match_ss(file_name, needle_file)) {
-                new_state.selected_index = (int32_t)(next_cell - new_state.cells);
-            }
-            
-            *next_cell++ = tldui_print_table_cell(app, &printer, file_name);
-        }
+    Buffer_Summary buffer = get_buffer(app, view->buffer_id, AccessAll);
+    
+    char hot_dir_space[1024];
+    String hot_dir = make_fixed_width_string(hot_dir_space);
+    hot_dir.size = directory_get_hot(app, hot_dir.str, hot_dir.memory_size);
+    
+    tld_files_results_show(&state->results, state, state->entry_count + TLDFM_SEARCH_RESULT_STEP);
+    if (!tld_files_layout(state)) {
+        tld_files_state_free(state);
+        return;
     }
     
-    free_file_list(app, contents);
-    return new_state;
+    tld_files_print(app, &buffer, state, hot_dir, literal(tld_files_search_header));
+}
+
+static inline void
+tld_files_view_update_highlight(Application_Links *app,
+                                View_Summary *view,
+                                tld_file_manager_state *state)
+{
+    if (state->entry_count) {
+        tldui_vlist_show_row(app, view, &state->list,
+                             tld_files_entry_row(state, state->selected_index));
+        view_set_highlight(app, view, state->cells[state->selected_index].min,
+                           state->cells[state->selected_index].max, true);
+    } else {
+        view_set_highlight(app, view, 0, 0, 0);
+    }
 }
 
-#ifndef TLDFM_SEARCH_RESULT_CAPACITY
-#define TLDFM_SEARCH_RESULT_CAPACITY 1024
+// 
+// Live Search
+// 
+
+// tld_files_find_recursive searches while the pattern is typed. A thread of
+// its own collects the paths of the files below the hot directory, from the
+// index if it covers the directory, or by walking the tree, and matches them
+// against the latest pattern. Neither holds up the query bar.
+// A new pattern cancels the pass for the previous one. If it extends the
+// previous pattern, only the previous matches are checked again, since a file
+// can only match a pattern if it matches every prefix of it; otherwise, the
+// files collected so far are. Either way, the walk picks up where it left
+// off, and nothing is read from disk twice.
+// The best TLDFM_SEARCH_RESULT_STEP matches are published every
+// TLDFM_FIND_FRAME_TIME milliseconds. The query waits that long for a pass
+// after every keystroke, then shows what was published every frame until the
+// pass is done, and waits for the pass to finish when enter is pressed, to
+// show all matches.
+// The walk checks for a new pattern every TLDFM_FIND_WALK_BUDGET directories.
+// Without the parallel walk, the search only starts once enter is pressed.
+
+#ifndef TLDFM_FIND_FRAME_TIME
+#define TLDFM_FIND_FRAME_TIME 16
+#endif
+
+#ifndef TLDFM_FIND_WALK_BUDGET
+#define TLDFM_FIND_WALK_BUDGET 256
 #endif
 
+#ifdef TLDFM_PARALLEL_WALK
+
+struct tld_files_finder {
+    // Only touched by the search thread
+    String base_path;
+    // Whether the files were taken from the index, or the walk was begun
+    bool32 collecting;
+    // The walk of the tree, or 0 once it's done, or if the index covers it
+    tld_walk *walk;
+    // The paths of the files found so far, relative to the hot directory
+    tld_files_results candidates;
+    // Candidates [0, matched) were checked against the working pattern, and
+    // hits are the ones that matched, in order, with their paths in the
+    // candidates' blocks
+    int32_t matched;
+    tld_files_results hits;
+    tld_file_manager_state ranked;
+    String working_pattern;
+    tld_fuzzy_scratch scratch;
+    
+    // Guarded by the mutex
+    String pattern;
+    int32_t generation;
+    // The paths of the best hits, best first
+    tld_file_manager_state published;
+    int32_t published_generation;
+    int32_t published_version;
+    bool32 published_done;
+    bool32 quit;
+    
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    
+    char base_path_space[1024];
+    char pattern_space[1024];
+    char working_pattern_space[1024];
+};
+
+static inline int32_t
+tld_files_finder_match(tld_files_finder *finder, tld_files_hit *candidate) {
+    String name = front_of_directory(make_string(candidate->path, candidate->path_size));
+    return tld_fuzzy_match_ss(finder->working_pattern, name, &finder->scratch);
+}
+
+// Keeps the hits that match the working pattern, which extends the pattern
+// they were found for
 static void
-tld_print_search_results_recursive(Application_Links *app,
-                                   Buffer_Summary *buffer,
-                                   String base_path,
-                                   String pattern,
-                                   int32_t hot_dir_len,
-                                   tld_file_manager_state *new_state)
-{
-    String base_path_visible = substr_tail(base_path, hot_dir_len);
+tld_files_finder_refine(tld_files_finder *finder) {
+    int32_t hit_count = 0;
+    for (int32_t i = 0; i < finder->hits.hit_count; ++i) {
+        tld_files_hit hit = *tld_files_results_get(&finder->hits, i);
+        hit.score = tld_files_finder_match(finder, &hit);
+        if (hit.score) {
+            *tld_files_results_get(&finder->hits, hit_count++) = hit;
+        }
+    }
     
-    File_List contents = get_file_list(app, expand_str(base_path));
-    for (uint32_t i = 0;
-         i < contents.count && new_state->entry_count < TLDFM_SEARCH_RESULT_CAPACITY;
-         ++i)
-    {
-        if (contents.infos[i].folder) continue;
+    finder->hits.hit_count = hit_count;
+}
+
+// Matches the next chunk of candidates against the working pattern, or, if
+// all of them were, walks a little more of the tree.
+// Returns whether all matches were found.
+static bool32
+tld_files_finder_step(tld_files_finder *finder) {
+    if (!finder->collecting) {
+        finder->collecting = true;
+        if (!tld_files_index_search(finder->base_path, make_lit_string(""), &finder->candidates)) {
+            finder->walk = tld_walk_begin(finder->base_path, make_lit_string(""));
+        }
+        return false;
+    }
+    
+    int32_t candidate_count = finder->candidates.hit_count;
+    if (finder->matched < candidate_count) {
+        int32_t end = finder->matched + min(candidate_count - finder->matched, TLDUI_FUZZY_CHUNK_SIZE);
+        for (int32_t i = finder->matched; i < end; ++i) {
+            tld_files_hit hit = *tld_files_results_get(&finder->candidates, i);
+            hit.score = tld_files_finder_match(finder, &hit);
+            if (hit.score && !tld_files_results_push_hit(&finder->hits, hit)) return true;
+        }
         
-        String file_name = make_string(contents.infos[i].filename, contents.infos[i].filename_len);
-        if (tld_fuzzy_match_ss(pattern, file_name)) {
-            new_state->cells[new_state->entry_count] = make_range(
-                buffer->size, buffer->size + base_path_visible.size + file_name.size);
-            new_state->entry_count += 1;
-            
-            buffer_replace_range(app, buffer, buffer->size, buffer->size,
-                                 expand_str(base_path_visible));
-            buffer_replace_range(app, buffer, buffer->size, buffer->size, expand_str(file_name));
-            buffer_replace_range(app, buffer, buffer->size, buffer->size, literal("\n"));
+        finder->matched = end;
+        return false;
+    }
+    
+    if (finder->walk) {
+        tld_walk *walk = finder->walk;
+        bool32 walked = tld_walk_run(walk, TLDFM_FIND_WALK_BUDGET);
+        
+        bool32 collected = true;
+        for (int32_t i = 0; i < walk->worker_count; ++i) {
+            collected &= tld_files_results_merge(&finder->candidates, &walk->workers[i].hits);
         }
         
+        if (walked || !collected) {
+            tld_walk_end(walk);
+            finder->walk = 0;
+        }
+        return false;
     }
     
-    for (uint32_t i = 0;
-         i < contents.count && new_state->entry_count < TLDFM_SEARCH_RESULT_CAPACITY;
-         ++i)
-    {
-        if (contents.infos[i].folder) {
-            int32_t old_size = base_path.size;
+    return true;
+}
+
+static void *
+tld_files_finder_thread_main(void *param) {
+    tld_files_finder *finder = (tld_files_finder *) param;
+    int32_t generation = 0;
+    bool32 done = true;
+    bool32 publish_now = false;
+    struct timespec last_publish;
+    
+    pthread_mutex_lock(&finder->mutex);
+    while (true) {
+        while (!finder->quit && finder->generation == generation && done) {
+            pthread_cond_wait(&finder->changed, &finder->mutex);
+        }
+        if (finder->quit) break;
+        
+        if (finder->generation != generation) {
+            String old_pattern = finder->working_pattern;
+            String pattern = finder->pattern;
+            bool32 refines = (old_pattern.size <= pattern.size &&
+                              memcmp(old_pattern.str, pattern.str, old_pattern.size) == 0);
             
-            if (base_path.memory_size - old_size > contents.infos[i].filename_len) {
-                append(&base_path,
-                       make_string(contents.infos[i].filename, contents.infos[i].filename_len));
-                append(&base_path, "/");
-                
-                tld_print_search_results_recursive(app, buffer, base_path, pattern, hot_dir_len, new_state);
-                
-                base_path.size = old_size;
+            copy_partial_ss(&finder->working_pattern, pattern);
+            generation = finder->generation;
+            finder->published.entry_count = 0;
+            finder->published.names_size = 0;
+            finder->published_generation = generation;
+            finder->published_done = false;
+            pthread_mutex_unlock(&finder->mutex);
+            
+            if (refines) {
+                tld_files_finder_refine(finder);
+            } else {
+                finder->hits.hit_count = 0;
+                finder->matched = 0;
             }
+            publish_now = true;
+        } else {
+            pthread_mutex_unlock(&finder->mutex);
+        }
+        
+        done = tld_files_finder_step(finder);
+        
+        bool32 publish = (done || publish_now ||
+                          tld_milliseconds_since(&last_publish) >= TLDFM_FIND_FRAME_TIME);
+        if (publish) {
+            finder->ranked.entry_count = 0;
+            finder->ranked.names_size = 0;
+            tld_files_results_show(&finder->hits, &finder->ranked, TLDFM_SEARCH_RESULT_STEP);
+        }
+        
+        pthread_mutex_lock(&finder->mutex);
+        if (publish && finder->generation == generation) {
+            tld_file_manager_state published = finder->published;
+            finder->published = finder->ranked;
+            finder->ranked = published;
+            finder->published_version += 1;
+            finder->published_done = done;
+            pthread_cond_broadcast(&finder->changed);
+            
+            clock_gettime(CLOCK_MONOTONIC, &last_publish);
+            publish_now = false;
         }
     }
+    pthread_mutex_unlock(&finder->mutex);
     
-    free_file_list(app, contents);
+    return 0;
 }
 
-char tld_files_search_header[] =
-"\n===[ Search Results ]======================================================================\n";
-
-static tld_file_manager_state
-tld_print_search_results(Application_Links *app,
-                         Buffer_Summary *buffer,
-                         String base_path,
-                         String pattern)
-{
-    tld_file_manager_state new_state = {0};
-    new_state.cells = (Range *) malloc(TLDFM_SEARCH_RESULT_CAPACITY * sizeof(Range));
-    new_state.showing_search_results = true;
-    if (new_state.cells == 0) return new_state;
-    
-    buffer_replace_range(app, buffer, 0, buffer->size, expand_str(base_path));
-    buffer_replace_range(app, buffer, buffer->size, buffer->size, literal(tld_files_search_header));
+// Starts searching the files below base_path for the empty pattern.
+// Returns 0 if the search can't be started.
+static tld_files_finder *
+tld_files_finder_start(String base_path) {
+    tld_files_finder *finder = (tld_files_finder *) calloc(1, sizeof(tld_files_finder));
+    if (finder == 0) return 0;
+    
+    finder->base_path = make_fixed_width_string(finder->base_path_space);
+    finder->pattern = make_fixed_width_string(finder->pattern_space);
+    finder->working_pattern = make_fixed_width_string(finder->working_pattern_space);
+    finder->generation = 1;
+    copy_partial_ss(&finder->base_path, base_path);
+    
+    pthread_mutex_init(&finder->mutex, 0);
+    pthread_cond_init(&finder->changed, 0);
+    
+    if (pthread_create(&finder->thread, 0, tld_files_finder_thread_main, finder) != 0) {
+        pthread_cond_destroy(&finder->changed);
+        pthread_mutex_destroy(&finder->mutex);
+        free(finder);
+        return 0;
+    }
     
-    tld_print_search_results_recursive(app, buffer, base_path, pattern, base_path.size, &new_state);
+    return finder;
+}
+
+// Stops searching, and, if results is not 0, moves the matches of the last
+// pass there. Wait for the pass to finish first, or they are incomplete.
+static void
+tld_files_finder_stop(tld_files_finder *finder, tld_files_results *results) {
+    pthread_mutex_lock(&finder->mutex);
+    finder->quit = true;
+    pthread_cond_broadcast(&finder->changed);
+    pthread_mutex_unlock(&finder->mutex);
+    
+    pthread_join(finder->thread, 0);
+    pthread_cond_destroy(&finder->changed);
+    pthread_mutex_destroy(&finder->mutex);
+    
+    if (results) {
+        tld_files_results_free(results);
+        *results = finder->hits;
+        finder->hits = {0};
+        tld_files_results_take_paths(results, &finder->candidates);
+    }
     
-    return new_state;
+    if (finder->walk) tld_walk_end(finder->walk);
+    tld_files_results_free(&finder->candidates);
+    tld_files_results_free(&finder->hits);
+    tld_files_state_free(&finder->ranked);
+    tld_files_state_free(&finder->published);
+    tld_fuzzy_scratch_free(&finder->scratch);
+    free(finder);
 }
 
-static int32_t
-__tld_get_column_index(Application_Links *app,
-                       Buffer_Summary *buffer,
-                       Range *cells,
-                       int32_t cell_count,
-                       int32_t index)
-{
-    int32_t result = 0;
-    while (index > 0) {
-        Range r = make_range(cells[index - 1].max, cells[index].min);
-        char chunk[256];
-        
-        Assert(sizeof(chunk) >= (r.max - r.min));
-        buffer_read_range(app, buffer, r.min, r.max, chunk);
-        for (int i = 0; i < r.max - r.min; ++i) {
-            if (chunk[i] == '\n') {
-                goto double_break;
-            }
+// Cancels the pass for the previous pattern, and starts one for this one
+static void
+tld_files_finder_request(tld_files_finder *finder, String pattern) {
+    pthread_mutex_lock(&finder->mutex);
+    copy_partial_ss(&finder->pattern, pattern);
+    finder->generation += 1;
+    pthread_cond_broadcast(&finder->changed);
+    pthread_mutex_unlock(&finder->mutex);
+}
+
+// Waits up to the given number of milliseconds, or as long as it takes if
+// that's negative, for the pass for the latest pattern to finish, and returns
+// whether it did.
+static bool32
+tld_files_finder_wait(tld_files_finder *finder, int32_t milliseconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (milliseconds % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    
+    pthread_mutex_lock(&finder->mutex);
+    while (finder->published_generation != finder->generation || !finder->published_done) {
+        if (milliseconds < 0) {
+            pthread_cond_wait(&finder->changed, &finder->mutex);
+        } else if (pthread_cond_timedwait(&finder->changed, &finder->mutex, &deadline) != 0) {
+            break;
         }
-        
-        result += 1;
-        index  -= 1;
     }
+    bool32 result = (finder->published_generation == finder->generation && finder->published_done);
+    pthread_mutex_unlock(&finder->mutex);
     
-    double_break:
     return result;
 }
 
-static int32_t
-__tld_get_remaining_columns(Application_Links *app,
-                            Buffer_Summary *buffer,
-                            Range *cells,
-                            int32_t cell_count,
-                            int32_t index)
-{
-    int32_t result = 0;
-    while (index < cell_count - 1) {
-        Range r = make_range(cells[index].max, cells[index + 1].min);
-        char chunk[256];
-        
-        Assert(sizeof(chunk) >= (r.max - r.min));
-        buffer_read_range(app, buffer, r.min, r.max, chunk);
-        for (int i = 0; i < r.max - r.min; ++i) {
-            if (chunk[i] == '\n') {
-                goto double_break;
-            }
-        }
+// Fills state with the best matches published for the latest pattern, if
+// they changed since *version was last updated by this function.
+// Returns whether they did.
+static bool32
+tld_files_finder_poll(tld_files_finder *finder, tld_file_manager_state *state, int32_t *version) {
+    pthread_mutex_lock(&finder->mutex);
+    
+    tld_file_manager_state *published = &finder->published;
+    bool32 changed = (finder->published_generation == finder->generation &&
+                      finder->published_version != *version);
+    if (changed) {
+        *version = finder->published_version;
+        tld_files_state_free(state);
+        state->showing_search_results = true;
         
-        result += 1;
-        index  += 1;
+        for (int32_t i = 0; i < published->entry_count; ++i) {
+            if (!tld_files_push_entry(state, {0}, tld_files_entry_name(published, i))) break;
+        }
     }
     
-    double_break:
-    return result;
+    pthread_mutex_unlock(&finder->mutex);
+    return changed;
 }
 
-static inline void
-tld_files_view_update_highlight(Application_Links *app,
-                                View_Summary *view,
-                                tld_file_manager_state *state)
+#else
+
+struct tld_files_finder;
+static inline tld_files_finder *tld_files_finder_start(String base_path) { return 0; }
+static inline void tld_files_finder_stop(tld_files_finder *finder, tld_files_results *results) {}
+static inline void tld_files_finder_request(tld_files_finder *finder, String pattern) {}
+static inline bool32 tld_files_finder_wait(tld_files_finder *finder, int32_t milliseconds) { return true; }
+static inline bool32 tld_files_finder_poll(tld_files_finder *finder, tld_file_manager_state *state, int32_t *version) { return false; }
+
+#endif
+
+// Shows the latest matches, if they changed. Returns whether they did.
+static bool32
+tld_files_finder_show(Application_Links *app, View_Summary *view, Buffer_Summary *buffer,
+                      tld_files_finder *finder, String base_path, int32_t *version,
+                      tld_file_manager_state *state)
 {
-    if (state->entry_count) {
-        view_set_highlight(app, view, state->cells[state->selected_index].min,
-                           state->cells[state->selected_index].max, true);
+    if (!tld_files_finder_poll(finder, state, version)) return false;
+    
+    if (tld_files_layout(state)) {
+        tld_files_print(app, buffer, state, base_path, literal(tld_files_search_header));
     } else {
-        view_set_highlight(app, view, 0, 0, 0);
+        tld_files_state_free(state);
     }
+    tld_files_view_update_highlight(app, view, state);
+    
+    return true;
 }
 
 static uint32_t tld_files_buffer_mapid = 0;
@@ -229,100 +2776,79 @@ CUSTOM_COMMAND_SIG(tld_files_move_left) {
     if (tld_files_state.cells == 0 || tld_files_state.entry_count == 0) return;
     
     View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
     
     int32_t selected_index = tld_files_state.selected_index - 1;
     if (selected_index < 0) selected_index = 0;
     
     tld_files_state.selected_index = selected_index;
-    
-    view_set_highlight(app, &view, tld_files_state.cells[tld_files_state.selected_index].min,
-                       tld_files_state.cells[tld_files_state.selected_index].max, true);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
 CUSTOM_COMMAND_SIG(tld_files_move_right) {
     if (tld_files_state.cells == 0 || tld_files_state.entry_count == 0) return;
     
     View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+    
+    tld_files_show_more_results(app, &view, &tld_files_state);
+    if (tld_files_state.cells == 0) return;
     
     int32_t selected_index = tld_files_state.selected_index + 1;
     if (selected_index >= tld_files_state.entry_count)
         selected_index = tld_files_state.entry_count - 1;
     tld_files_state.selected_index = selected_index;
     
-    view_set_highlight(app, &view, tld_files_state.cells[tld_files_state.selected_index].min,
-                       tld_files_state.cells[tld_files_state.selected_index].max, true);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
 CUSTOM_COMMAND_SIG(tld_files_move_up) {
     if (tld_files_state.cells == 0 || tld_files_state.entry_count == 0) return;
     
     View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
     
-    int32_t current_column = __tld_get_column_index(app, &buffer,
-                                                    tld_files_state.cells,
-                                                    tld_files_state.entry_count,
-                                                    tld_files_state.selected_index);
-    if (tld_files_state.selected_index - current_column) {
-        int32_t last_on_prev_line = tld_files_state.selected_index - current_column - 1;
-        int32_t prev_line_col_count = 1 + __tld_get_column_index(app, &buffer,
-                                                                 tld_files_state.cells,
-                                                                 tld_files_state.entry_count,
-                                                                 last_on_prev_line);
-        if (prev_line_col_count > current_column) {
-            tld_files_state.selected_index -= prev_line_col_count;
-        } else {
-            tld_files_state.selected_index -= current_column + 1;
-        }
+    int32_t *row_entries = tld_files_state.row_entries;
+    int32_t row = tld_files_entry_row(&tld_files_state, tld_files_state.selected_index);
+    int32_t current_column = tld_files_state.selected_index - row_entries[row];
+    
+    int32_t prev_row = tld_files_next_entry_row(&tld_files_state, row, -1);
+    if (prev_row >= 0) {
+        int32_t prev_row_col_count = row_entries[prev_row + 1] - row_entries[prev_row];
+        tld_files_state.selected_index =
+            row_entries[prev_row] + min(current_column, prev_row_col_count - 1);
     } else {
         tld_files_state.selected_index = 0;
     }
     
-    view_set_highlight(app, &view, tld_files_state.cells[tld_files_state.selected_index].min,
-                       tld_files_state.cells[tld_files_state.selected_index].max, true);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
 CUSTOM_COMMAND_SIG(tld_files_move_down) {
     if (tld_files_state.cells == 0 || tld_files_state.entry_count == 0) return;
     
     View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
     
-    int32_t current_column = __tld_get_column_index(app, &buffer,
-                                                    tld_files_state.cells,
-                                                    tld_files_state.entry_count,
-                                                    tld_files_state.selected_index);
-    int32_t remaining_columns = __tld_get_remaining_columns(app, &buffer,
-                                                            tld_files_state.cells,
-                                                            tld_files_state.entry_count,
-                                                            tld_files_state.selected_index);
-    int32_t first_on_next_line = tld_files_state.selected_index + remaining_columns + 1;
-    
-    if (first_on_next_line >= tld_files_state.entry_count) {
-        tld_files_state.selected_index = tld_files_state.entry_count - 1;
+    tld_files_show_more_results(app, &view, &tld_files_state);
+    if (tld_files_state.cells == 0) return;
+    
+    int32_t *row_entries = tld_files_state.row_entries;
+    int32_t row = tld_files_entry_row(&tld_files_state, tld_files_state.selected_index);
+    int32_t current_column = tld_files_state.selected_index - row_entries[row];
+    
+    int32_t next_row = tld_files_next_entry_row(&tld_files_state, row, 1);
+    if (next_row >= 0) {
+        int32_t next_row_col_count = row_entries[next_row + 1] - row_entries[next_row];
+        tld_files_state.selected_index =
+            row_entries[next_row] + min(current_column, next_row_col_count - 1);
     } else {
-        int32_t remaining_on_next_line = __tld_get_remaining_columns(app, &buffer,
-                                                                     tld_files_state.cells,
-                                                                     tld_files_state.entry_count,
-                                                                     first_on_next_line);
-        if (remaining_on_next_line > current_column) {
-            tld_files_state.selected_index = first_on_next_line + current_column;
-        } else {
-            tld_files_state.selected_index = first_on_next_line + remaining_on_next_line;
-        }
+        tld_files_state.selected_index = tld_files_state.entry_count - 1;
     }
     
-    view_set_highlight(app, &view, tld_files_state.cells[tld_files_state.selected_index].min,
-                       tld_files_state.cells[tld_files_state.selected_index].max, true);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
 CUSTOM_COMMAND_SIG(tld_files_find) {
     if (tld_files_state.cells == 0 || tld_files_state.entry_count == 0) return;
     
     View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
     
     char find_bar_space[1024];
     Query_Bar find_bar = {0};
@@ -331,13 +2857,11 @@ CUSTOM_COMMAND_SIG(tld_files_find) {
     start_query_bar(app, &find_bar, 0);
     
     int selected_index = 0;
+    tld_fuzzy_scratch scratch = {0};
     
     while (true) {
         User_Input in = get_user_input(app, EventOnAnyKey, EventOnEsc);
         
-        char file_name_space[1024];
-        String file_name = make_fixed_width_string(file_name_space);
-        
         if (in.abort || in.key.keycode == '\n') {
             tld_files_state.selected_index = selected_index;
             break;
@@ -356,22 +2880,18 @@ CUSTOM_COMMAND_SIG(tld_files_find) {
         for (int i = selected_index;
              i < tld_files_state.entry_count; ++i)
         {
-            Range r = tld_files_state.cells[i];
-            if (file_name.memory_size > r.max - r.min &&
-                buffer_read_range(app, &buffer, r.min, r.max, file_name.str))
-            {
-                file_name.size = r.max - r.min;
-                if (tld_fuzzy_match_ss(find_bar.string, file_name)) {
-                    selected_index = i;
-                    break;
-                }
+            String file_name = tld_files_entry_name(&tld_files_state, i);
+            if (tld_fuzzy_match_ss(find_bar.string, file_name, &scratch)) {
+                selected_index = i;
+                break;
             }
         }
         
-        view_set_highlight(app, &view, tld_files_state.cells[selected_index].min,
-                           tld_files_state.cells[selected_index].max, true);
+        tld_files_state.selected_index = selected_index;
+        tld_files_view_update_highlight(app, &view, &tld_files_state);
     }
     
+    tld_fuzzy_scratch_free(&scratch);
     end_query_bar(app, &find_bar, 0);
 }
 
@@ -381,20 +2901,44 @@ CUSTOM_COMMAND_SIG(tld_files_find_recursive) {
     View_Summary view = get_active_view(app, AccessAll);
     Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
     
+    char hot_dir_space[1024];
+    String hot_dir = make_fixed_width_string(hot_dir_space);
+    hot_dir.size = directory_get_hot(app, hot_dir.str, hot_dir.memory_size);
+    
     char find_bar_space[1024];
     Query_Bar find_bar = {0};
     find_bar.prompt = make_lit_string("Find File: ");
     find_bar.string = make_fixed_width_string(find_bar_space);
     start_query_bar(app, &find_bar, 0);
     
+    // Files are collected while the first character is typed
+    tld_files_index_report(app);
+    tld_files_finder *finder = tld_files_finder_start(hot_dir);
+    int32_t version = 0;
+    bool32 shown = false;
+    bool32 searching = false;
+    
     while (true) {
-        User_Input in = get_user_input(app, EventOnAnyKey, EventOnEsc);
+        // Until the pass is done, what it found is shown every frame
+        uint32_t get_type = EventOnAnyKey;
+        if (searching) get_type |= EventOnAnimate;
+        
+        User_Input in = get_user_input(app, get_type, EventOnEsc);
+        bool32 pattern_changed = false;
         
         if (in.abort) {
+            if (finder) {
+                tld_files_finder_stop(finder, 0);
+                if (shown) {
+                    tld_print_directory(app, &buffer, hot_dir, {0}, &tld_files_state);
+                    tld_files_view_update_highlight(app, &view, &tld_files_state);
+                }
+            }
             return;
         } else if (in.key.keycode == '\n') {
             break;
         } else if (in.key.keycode == key_back) {
+            pattern_changed = (find_bar.string.size > 0);
             backspace_utf8(&find_bar.string);
         } else if (key_is_unmodified(&in.key)) {
             uint8_t character[4];
@@ -402,15 +2946,30 @@ CUSTOM_COMMAND_SIG(tld_files_find_recursive) {
             if (length != 0 && find_bar.string.memory_size - find_bar.string.size > (int32_t)length)
             {
                 append_ss(&find_bar.string, make_string((char *) &character, length));
+                pattern_changed = true;
+            }
+        }
+        
+        if (finder && (pattern_changed || searching)) {
+            if (pattern_changed) {
+                tld_files_finder_request(finder, find_bar.string);
             }
+            searching = !tld_files_finder_wait(finder, pattern_changed ? TLDFM_FIND_FRAME_TIME : 0);
+            shown |= tld_files_finder_show(app, &view, &buffer, finder, hot_dir,
+                                           &version, &tld_files_state);
         }
     }
     
-    char hot_dir_space[1024];
-    String hot_dir = make_fixed_width_string(hot_dir_space);
-    hot_dir.size = directory_get_hot(app, hot_dir.str, hot_dir.memory_size);
-    
-    tld_files_state = tld_print_search_results(app, &buffer, hot_dir, find_bar.string);
+    if (finder) {
+        tld_files_finder_wait(finder, -1);
+        
+        tld_files_state_free(&tld_files_state);
+        tld_files_state.showing_search_results = true;
+        tld_files_finder_stop(finder, &tld_files_state.results);
+        tld_files_print_results(app, &buffer, hot_dir, &tld_files_state);
+    } else {
+        tld_print_search_results(app, &buffer, hot_dir, find_bar.string, &tld_files_state);
+    }
     tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
@@ -424,38 +2983,32 @@ CUSTOM_COMMAND_SIG(tld_files_open_selected) {
     String hot_dir = make_fixed_width_string(hot_dir_space);
     hot_dir.size = directory_get_hot(app, hot_dir.str, hot_dir.memory_size);
     
-    Range r = tld_files_state.cells[tld_files_state.selected_index];
+    String name = tld_files_entry_name(&tld_files_state, tld_files_state.selected_index);
     if (tld_files_state.selected_index < tld_files_state.directory_count) {
-        if (hot_dir.memory_size - hot_dir.size > r.max - r.min) {
-            if (buffer_read_range(app, &buffer, r.min, r.max, hot_dir.str + hot_dir.size)) {
-                hot_dir.size += r.max - r.min;
-                append(&hot_dir, "/");
-                
-                free(tld_files_state.cells);
-                tld_files_state = tld_print_directory(app, &buffer, hot_dir, {0});
-                directory_set_hot(app, expand_str(hot_dir));
-            }
+        if (hot_dir.memory_size - hot_dir.size > name.size) {
+            append_ss(&hot_dir, name);
+            append(&hot_dir, "/");
+            
+            tld_print_directory(app, &buffer, hot_dir, {0}, &tld_files_state);
+            directory_set_hot(app, expand_str(hot_dir));
         }
     } else {
-        if (hot_dir.memory_size - hot_dir.size > r.max - r.min) {
-            if (buffer_read_range(app, &buffer, r.min, r.max, hot_dir.str + hot_dir.size)) {
-                hot_dir.size += r.max - r.min;
-                Buffer_Summary new_buffer = create_buffer(app, expand_str(hot_dir), 0);
+        if (hot_dir.memory_size - hot_dir.size > name.size) {
+            append_ss(&hot_dir, name);
+            Buffer_Summary new_buffer = create_buffer(app, expand_str(hot_dir), 0);
+            
+            if (new_buffer.exists) {
+                tld_files_state_free(&tld_files_state);
                 
-                if (new_buffer.exists) {
-                    free(tld_files_state.cells);
-                    tld_files_state = {0};
-                    
-                    kill_buffer(app, buffer_identifier(buffer.buffer_id),
-                                view.view_id, BufferKill_AlwaysKill);
-                    
-                    view_set_setting(app, &view, ViewSetting_ShowFileBar, 1);
-                    view_set_highlight(app, &view, 0, 0, 0);
-                    view_set_buffer(app, &view, new_buffer.buffer_id, 0);
-                }
+                kill_buffer(app, buffer_identifier(buffer.buffer_id),
+                            view.view_id, BufferKill_AlwaysKill);
                 
-                return;
+                view_set_setting(app, &view, ViewSetting_ShowFileBar, 1);
+                view_set_highlight(app, &view, 0, 0, 0);
+                view_set_buffer(app, &view, new_buffer.buffer_id, 0);
             }
+            
+            return;
         }
     }
     
@@ -466,7 +3019,6 @@ CUSTOM_COMMAND_SIG(tld_files_click_select) {
     if (tld_files_state.cells == 0) return;
     
     View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
     
     Mouse_State mouse = get_mouse_state(app);
     float rx = 0, ry = 0;
@@ -477,7 +3029,13 @@ CUSTOM_COMMAND_SIG(tld_files_click_select) {
         if (view_compute_cursor(app, &view, seek_xy(rx, ry, 1, view.unwrapped_lines), &click_pos)) {
             int32_t selected_index = -1;
             
-            for (int i = 0; i < tld_files_state.entry_count; ++i) {
+            // Only the entries of the row clicked on can be there
+            int32_t row = tldui_vlist_row_at_pos(&tld_files_state.list, click_pos.pos);
+            if (row < 0) return;
+            
+            for (int i = tld_files_state.row_entries[row];
+                 i < tld_files_state.row_entries[row + 1]; ++i)
+            {
                 if (tld_files_state.cells[i].min <= click_pos.pos &&
                     click_pos.pos <= tld_files_state.cells[i].max)
                 {
@@ -510,12 +3068,27 @@ CUSTOM_COMMAND_SIG(tld_files_goto_parent_directory) {
     
     if (!tld_files_state.showing_search_results) {
         if (directory_cd(app, hot_dir.str, &hot_dir.size, hot_dir.memory_size, literal(".."))) {
-            free(tld_files_state.cells);
             directory_set_hot(app, expand_str(hot_dir));
         }
     }
     
-    tld_files_state = tld_print_directory(app, &buffer, hot_dir, {0});
+    tld_print_directory(app, &buffer, hot_dir, {0}, &tld_files_state);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
+}
+
+// Lists the hot directory again, even if its listing is cached
+CUSTOM_COMMAND_SIG(tld_files_refresh) {
+    if (tld_files_state.cells == 0) return;
+    
+    View_Summary view = get_active_view(app, AccessAll);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+    
+    char hot_dir_space[1024];
+    String hot_dir = make_fixed_width_string(hot_dir_space);
+    hot_dir.size = directory_get_hot(app, hot_dir.str, hot_dir.memory_size);
+    
+    tld_files_dir_cache_forget(hot_dir);
+    tld_print_directory(app, &buffer, hot_dir, {0}, &tld_files_state);
     tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
@@ -530,8 +3103,7 @@ CUSTOM_COMMAND_SIG(tld_files_close_buffer) {
     view_set_setting(app, &view, ViewSetting_ShowFileBar, 1);
     view_set_highlight(app, &view, 0, 0, 0);
     
-    free(tld_files_state.cells);
-    tld_files_state = {0};
+    tld_files_state_free(&tld_files_state);
 }
 
 // Display the *files* buffer and pretty print the contents of the current hot directory
@@ -552,9 +3124,8 @@ CUSTOM_COMMAND_SIG(tld_files_show_hot_dir) {
     String hot_dir = make_fixed_width_string(hot_dir_space);
     hot_dir.size = directory_get_hot(app, hot_dir.str, hot_dir.memory_size);
     
-    tld_files_state = tld_print_directory(app, &buffer, hot_dir, {0});
-    view_set_highlight(app, &view, tld_files_state.cells[tld_files_state.selected_index].min,
-                       tld_files_state.cells[tld_files_state.selected_index].max, true);
+    tld_print_directory(app, &buffer, hot_dir, {0}, &tld_files_state);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
 #ifndef TLD_FILES_DIR_STACK_CAP
@@ -618,9 +3189,8 @@ CUSTOM_COMMAND_SIG(tld_files_show_directory_of_current_file) {
     }
     view_set_buffer(app, &view, buffer.buffer_id, 0);
     
-    tld_files_state = tld_print_directory(app, &buffer, hot_dir, file_name);
-    view_set_highlight(app, &view, tld_files_state.cells[tld_files_state.selected_index].min,
-                       tld_files_state.cells[tld_files_state.selected_index].max, true);
+    tld_print_directory(app, &buffer, hot_dir, file_name, &tld_files_state);
+    tld_files_view_update_highlight(app, &view, &tld_files_state);
 }
 
 static void
@@ -641,6 +3211,7 @@ tld_files_bind_map(Bind_Helper *context, uint32_t mapid) {
     
     bind(context, key_back, MDFR_NONE, tld_files_goto_parent_directory);
     bind(context, '\n', MDFR_NONE, tld_files_open_selected);
+    bind(context, 'r', MDFR_NONE, tld_files_refresh);
     bind(context, '.', MDFR_NONE, tld_files_directory_push);
     bind(context, ',', MDFR_NONE, tld_files_directory_pop);
     
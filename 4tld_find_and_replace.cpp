@@ -35,18 +35,19 @@ static void
 tldfr_list_all_matches(Application_Links *app, Buffer_Summary *list_buffer, Partition *part,
                        Search_Set *set, Search_Iter *iter)
 {
-    buffer_replace_range(app, list_buffer, 0, list_buffer->size, 0, 0);
+    tldui_batch batch = tldui_begin_batch(list_buffer, make_range(0, list_buffer->size));
     
     Search_Match match = search_next_match(app, set, iter);
     if (!match.found_match) {
-        tldui_print_text(app, list_buffer, literal("No matches found!\n"));
+        tldui_batch_print_text(&batch, literal("No matches found!\n"));
+        tldui_end_batch(app, &batch);
         return;
     }
     
-    tldui_print_text(app, list_buffer,
-                     match.buffer.buffer_name,
-                     match.buffer.buffer_name_len);
-    tldui_print_text(app, list_buffer, literal(":\n"));
+    tldui_batch_print_text(&batch,
+                           match.buffer.buffer_name,
+                           match.buffer.buffer_name_len);
+    tldui_batch_print_text(&batch, literal(":\n"));
     
     Partition line_part = partition_sub_part(part, (4 << 10));
     
@@ -59,17 +60,17 @@ tldfr_list_all_matches(Application_Links *app, Buffer_Summary *list_buffer, Part
             app, &match.buffer, seek_pos(match.start), &word_pos))
         {
             if (match.buffer.buffer_id != current_buffer_id) {
-                tldui_print_text(app, list_buffer, literal("\n"));
+                tldui_batch_print_text(&batch, literal("\n"));
                 if (match.buffer.file_name) {
-                    tldui_print_text(app, list_buffer,
-                                     match.buffer.file_name,
-                                     match.buffer.file_name_len);
+                    tldui_batch_print_text(&batch,
+                                           match.buffer.file_name,
+                                           match.buffer.file_name_len);
                 } else {
-                    tldui_print_text(app, list_buffer,
-                                     match.buffer.buffer_name,
-                                     match.buffer.buffer_name_len);
+                    tldui_batch_print_text(&batch,
+                                           match.buffer.buffer_name,
+                                           match.buffer.buffer_name_len);
                 }
-                tldui_print_text(app, list_buffer, literal(":\n"));
+                tldui_batch_print_text(&batch, literal(":\n"));
                 
                 current_buffer_id = match.buffer.buffer_id;
                 last_line = 0;
@@ -97,7 +98,7 @@ tldfr_list_all_matches(Application_Links *app, Buffer_Summary *list_buffer, Part
                 append_s_char(&out_line, ' ');
                 append_ss(&out_line, line_str);
                 append_s_char(&out_line, '\n');
-                tldui_print_text(app, list_buffer, expand_str(out_line));
+                tldui_batch_print_text(&batch, expand_str(out_line));
                 
                 end_temp_memory(line_temp);
             }
@@ -108,6 +109,8 @@ tldfr_list_all_matches(Application_Links *app, Buffer_Summary *list_buffer, Part
         
         match = search_next_match(app, set, iter);
     } while (match.found_match);
+    
+    tldui_end_batch(app, &batch);
 }
 
 static void
@@ -155,27 +158,30 @@ static inline tldfr_ui_state
 tldfr_print_search_ui(Application_Links *app, Buffer_Summary *buffer, tldfr_search *search)
 {
     tldfr_ui_state result = {0};
+    tldui_batch batch = tldui_begin_batch_append(buffer);
+    
+    tldui_batch_print_text(&batch, literal("(f)    Find what : "));
+    result.find_string_box = tldui_batch_print_dynamic_text(&batch, search->find_string);
     
-    tldui_print_text(app, buffer, literal("(f)    Find what : "));
-    result.find_string_box = tldui_print_dynamic_text(app, buffer, search->find_string);
+    tldui_batch_print_text(&batch, literal("\n(h) Replace with : "));
+    result.repl_string_box = tldui_batch_print_dynamic_text(&batch, search->replace_string);
     
-    tldui_print_text(app, buffer, literal("\n(h) Replace with : "));
-    result.repl_string_box = tldui_print_dynamic_text(app, buffer, search->replace_string);
+    tldui_batch_print_text(&batch, literal("\n\n "));
+    result.match_word_checkbox = tldui_batch_print_checkbox(
+        &batch, literal("Match (w)hole word only"), search->match_word);
     
-    tldui_print_text(app, buffer, literal("\n\n "));
-    result.match_word_checkbox = tldui_print_checkbox(
-        app, buffer, literal("Match (w)hole word only"), search->match_word);
+    tldui_batch_print_text(&batch, literal("\n "));
+    result.match_case_checkbox = tldui_batch_print_checkbox(
+        &batch, literal("Match (c)ase"), search->match_case);
     
-    tldui_print_text(app, buffer, literal("\n "));
-    result.match_case_checkbox = tldui_print_checkbox(
-        app, buffer, literal("Match (c)ase"), search->match_case);
+    tldui_batch_print_text(&batch, literal("\n "));
+    result.wrap_around_checkbox = tldui_batch_print_checkbox(
+        &batch, literal("Wra(p) around"), search->wrap_around);
     
-    tldui_print_text(app, buffer, literal("\n "));
-    result.wrap_around_checkbox = tldui_print_checkbox(
-        app, buffer, literal("Wra(p) around"), search->wrap_around);
+    tldui_batch_print_text(&batch, literal("\n\n(i) Search Up     | (I) Goto first match  | (r) Replace      | (a) List matches\n"));
+    tldui_batch_print_text(&batch, literal("(k) Search Down   | (K) Goto last match   | (R) Replace all  | (A) List matches in all buffers\n"));
     
-    tldui_print_text(app, buffer, literal("\n\n(i) Search Up     | (I) Goto first match  | (r) Replace      | (a) List matches\n"));
-    tldui_print_text(app, buffer, literal("(k) Search Down   | (K) Goto last match   | (R) Replace all  | (A) List matches in all buffers\n"));
+    tldui_end_batch(app, &batch);
     
     return result;
 }
@@ -0,0 +1,728 @@
+/******************************************************************************
+Author: Tristan Dannenberg
+Notice: No warranty is offered or implied; use this code at your own risk.
+*******************************************************************************
+LICENSE
+
+This software is dual-licensed to the public domain and under the following
+license: you are granted a perpetual, irrevocable license to copy, modify,
+publish, and distribute this file as you see fit.
+*******************************************************************************
+This file is a standalone benchmark for 4tld_fuzzy_match.h. It is not part of
+the customization layer, and builds without 4coder, save for its string
+library. For every requested size, it generates a corpus of file paths and one
+of command names, then reports:
+* the time tld_fuzzy_match_ss and the corpus matcher spend per candidate, and
+  that tld_fuzzy_match_batch does, if SIMD is enabled, after checking that it
+  computes the same scores as the corpus matcher,
+* the time tldui_fuzzy_refine takes from a keystroke to the ranked results,
+  over scripted queries that type, backspace and retype abbreviations of
+  random entries, the way one would in tldui_query_fuzzy_list,
+* the average number of survivors left after each pattern length.
+
+Build it on Linux from this directory, pointing the include path at the 4coder
+directory containing 4coder_lib/:
+    g++ -std=gnu++11 -O2 -I<4coder> 4tld_fuzzy_bench.cpp -o 4tld_fuzzy_bench -lpthread
+Add -mavx2 (or -march=native) to measure the 16 lane batch matcher.
+Run it with the corpus sizes to test, which default to 1000 100000 1000000:
+    ./4tld_fuzzy_bench [size...]
+
+With --check, it measures nothing, and instead checks the matchers against
+the generic scalar one, for patterns of 1 to TLD_BENCH_CHECK_MAX_PATTERN
+characters, over corpora of the given sizes, which default to 20000:
+* tld_fuzzy_match_ss, tld_fuzzy_match_text and the corpus' character masks,
+* tld_fuzzy_match_batch, scores and saved states, on batches of every size,
+* tldui_fuzzy_refine, typing each pattern one character at a time.
+It prints the first few mismatches and exits with 1 if there are any, so the
+matcher should be checked in every configuration it is built in:
+    g++ -std=gnu++11 -O2 -I<4coder> 4tld_fuzzy_bench.cpp -o check_sse2 -lpthread
+    g++ -std=gnu++11 -O2 -mavx2 -I<4coder> 4tld_fuzzy_bench.cpp -o check_avx2 -lpthread
+    g++ -std=gnu++11 -O2 -DTLDUI_DISABLE_SIMD -I<4coder> 4tld_fuzzy_bench.cpp -o check_scalar -lpthread
+    ./check_sse2 --check && ./check_avx2 --check && ./check_scalar --check
+
+Preprocessor Variables:
+* TLD_BENCH_SCRIPT_COUNT is the number of scripted queries per corpus. This
+  defaults to 64.
+* TLD_BENCH_RESULT_COUNT is the number of results ranked per keystroke. This
+  defaults to 64, same as TLD_FUZZY_RESULT_LIMIT in 4tld_custom_commands.cpp.
+* TLD_BENCH_CHECK_PATTERN_COUNT is the number of patterns --check tries per
+  pattern length and corpus. This defaults to 16.
+* TLD_BENCH_CHECK_MAX_PATTERN is the longest pattern --check tries. This
+  defaults to 8, the longest one tld_fuzzy_match_text has a fixed size table
+  for.
+* Any of the matcher's variables (see 4tld_fuzzy_match.h) may be defined on
+  the command line to compare configurations.
+******************************************************************************/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FSTRING_IMPLEMENTATION
+#include "4coder_lib/4coder_string.h"
+
+// Provided by the 4coder headers the matcher is usually included after
+typedef int32_t bool32;
+typedef int32_t b32_4tech;
+
+#ifndef Assert
+#define Assert(c) assert(c)
+#endif
+
+#ifndef ArrayCount
+#define ArrayCount(a) ((int32_t)(sizeof(a) / sizeof(*(a))))
+#endif
+
+#include "4tld_fuzzy_match.h"
+
+#ifndef TLD_BENCH_SCRIPT_COUNT
+#define TLD_BENCH_SCRIPT_COUNT 64
+#endif
+
+#ifndef TLD_BENCH_RESULT_COUNT
+#define TLD_BENCH_RESULT_COUNT 64
+#endif
+
+#ifndef TLD_BENCH_CHECK_PATTERN_COUNT
+#define TLD_BENCH_CHECK_PATTERN_COUNT 16
+#endif
+
+#ifndef TLD_BENCH_CHECK_MAX_PATTERN
+#define TLD_BENCH_CHECK_MAX_PATTERN 8
+#endif
+
+#define TLD_BENCH_MAX_PREFIX 16
+#define TLD_BENCH_MAX_ENTRY 256
+
+#if TLD_FUZZY_BATCH_LANES
+#define TLD_BENCH_CHECK_LANES TLD_FUZZY_BATCH_LANES
+#else
+#define TLD_BENCH_CHECK_LANES 1
+#endif
+
+static uint64_t
+tld_bench_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t
+tld_bench_random(uint64_t *state) {
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+// 
+// Corpus Generation
+// 
+
+static const char *tld_bench_words[] = {
+    "src", "include", "lib", "core", "util", "render", "audio", "net", "test",
+    "platform", "win32", "linux", "buffer", "string", "parser", "lexer",
+    "token", "file", "view", "panel", "command", "project", "config", "memory",
+    "arena", "thread", "job", "queue", "math", "vector", "font", "glyph",
+    "layout", "input", "event", "hook", "custom", "build", "docs", "assets",
+    "shader", "texture", "mesh", "scene", "widget", "list", "table", "cache",
+    "index", "search", "replace", "switch", "open", "close", "save", "seek",
+    "scope", "line", "cursor", "mark", "paste", "undo", "redo", "terminal",
+};
+
+static const char *tld_bench_extensions[] = {
+    ".cpp", ".h", ".c", ".txt", ".md", ".py", ".json", ".glsl",
+};
+
+static void
+tld_bench_append_word(String *out, uint64_t *rng, bool32 capitalize) {
+    const char *word = tld_bench_words[tld_bench_random(rng) % ArrayCount(tld_bench_words)];
+    int32_t start = out->size;
+    append_ss(out, make_string((void *) word, (int32_t) strlen(word)));
+    
+    if (capitalize && out->size > start && char_is_lower(out->str[start])) {
+        out->str[start] -= 'a' - 'A';
+    }
+}
+
+static void
+tld_bench_make_path(String *out, uint64_t *rng) {
+    int32_t depth = 1 + tld_bench_random(rng) % 6;
+    for (int32_t i = 0; i < depth; ++i) {
+        tld_bench_append_word(out, rng, false);
+        append_s_char(out, '/');
+    }
+    
+    bool32 camel_case = (tld_bench_random(rng) % 4) == 0;
+    int32_t words = 1 + tld_bench_random(rng) % 3;
+    for (int32_t i = 0; i < words; ++i) {
+        if (i > 0 && !camel_case) {
+            append_s_char(out, '_');
+        }
+        tld_bench_append_word(out, rng, camel_case && i > 0);
+    }
+    
+    const char *extension = tld_bench_extensions[tld_bench_random(rng) % ArrayCount(tld_bench_extensions)];
+    append_ss(out, make_string((void *) extension, (int32_t) strlen(extension)));
+}
+
+static void
+tld_bench_make_command(String *out, uint64_t *rng) {
+    if (tld_bench_random(rng) % 2) {
+        append_ss(out, make_lit_string("tld_"));
+    }
+    
+    int32_t words = 2 + tld_bench_random(rng) % 3;
+    for (int32_t i = 0; i < words; ++i) {
+        if (i > 0) {
+            append_s_char(out, '_');
+        }
+        tld_bench_append_word(out, rng, false);
+    }
+}
+
+typedef void tld_bench_generator(String *out, uint64_t *rng);
+
+static bool32
+tld_bench_make_corpus(tldui_fuzzy_corpus *corpus, tld_bench_generator *generate,
+                      int32_t count, uint64_t seed)
+{
+    uint64_t rng = seed;
+    char space[TLD_BENCH_MAX_ENTRY];
+    
+    for (int32_t i = 0; i < count; ++i) {
+        String entry = make_fixed_width_string(space);
+        generate(&entry, &rng);
+        if (!tldui_fuzzy_corpus_push(corpus, entry)) return false;
+    }
+    
+    return true;
+}
+
+// Types the way one would to find a given string: the first character of some
+// of its words, and a few more characters of some of them.
+static String
+tld_bench_make_abbreviation(String target, uint64_t *rng, char *space, int32_t capacity) {
+    String result = make_string_cap(space, 0, capacity);
+    
+    for (int32_t j = 0; j < target.size && result.size < capacity; ++j) {
+        if (j > 0 && !tld_char_is_separator(target.str[j - 1]) &&
+            !(char_is_lower(target.str[j - 1]) && char_is_upper(target.str[j])))
+        {
+            continue;
+        }
+        if (tld_char_is_separator(target.str[j]) || tld_bench_random(rng) % 3 == 0) {
+            continue;
+        }
+        
+        int32_t run = 1 + tld_bench_random(rng) % 3;
+        for (int32_t k = j; k < j + run && k < target.size && result.size < capacity; ++k) {
+            if (tld_char_is_separator(target.str[k])) break;
+            append_s_char(&result, target.str[k]);
+        }
+    }
+    
+    if (result.size == 0 && target.size > 0) {
+        append_s_char(&result, target.str[0]);
+    }
+    
+    return result;
+}
+
+// 
+// Measurements
+// 
+
+static int
+tld_bench_compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static double
+tld_bench_percentile_us(uint64_t *sorted, int32_t count, double fraction) {
+    if (count == 0) return 0;
+    
+    int32_t index = (int32_t)(fraction * (count - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+struct tld_bench_patterns {
+    int32_t count;
+    char space[TLD_BENCH_SCRIPT_COUNT][TLD_BENCH_MAX_PREFIX];
+    String patterns[TLD_BENCH_SCRIPT_COUNT];
+};
+
+static void
+tld_bench_measure_matchers(tldui_fuzzy_corpus *corpus, tld_bench_patterns *patterns,
+                           double *ss_ns, double *corpus_ns, double *batch_ns)
+{
+    tld_fuzzy_scratch scratch = {0};
+    int32_t pattern_count = min(patterns->count, 16);
+    int64_t checksum = 0;
+    
+    uint64_t start = tld_bench_now_ns();
+    for (int32_t p = 0; p < pattern_count; ++p) {
+        for (int32_t i = 0; i < corpus->count; ++i) {
+            checksum += tld_fuzzy_match_ss(patterns->patterns[p], tldui_fuzzy_corpus_get(corpus, i),
+                                           &scratch);
+        }
+    }
+    uint64_t ss_time = tld_bench_now_ns() - start;
+    
+    start = tld_bench_now_ns();
+    for (int32_t p = 0; p < pattern_count; ++p) {
+        char lowered[TLD_BENCH_MAX_PREFIX];
+        tld_fuzzy_pattern prepared = tld_fuzzy_make_pattern(patterns->patterns[p], lowered);
+        
+        for (int32_t i = 0; i < corpus->count; ++i) {
+            if ((prepared.mask & ~corpus->char_masks[i]) != 0) continue;
+            
+            tld_fuzzy_corpus_text text = tldui_fuzzy_corpus_text(corpus, i);
+            checksum -= tld_fuzzy_match_text(&prepared, &text, 0);
+        }
+    }
+    uint64_t corpus_time = tld_bench_now_ns() - start;
+    
+    // Both passes compute the same scores
+    if (checksum != 0) {
+        fprintf(stderr, "warning: corpus scores differ from tld_fuzzy_match_ss\n");
+    }
+    
+    double candidates = (double) pattern_count * corpus->count;
+    *ss_ns = ss_time / candidates;
+    *corpus_ns = corpus_time / candidates;
+    *batch_ns = 0;
+    
+#if TLD_FUZZY_BATCH_LANES
+    int32_t *scores = (int32_t *) malloc(sizeof(int32_t) * corpus->count);
+    if (scores) {
+        int32_t mismatches = 0;
+        uint64_t batch_time = 0;
+        
+        for (int32_t p = 0; p < pattern_count; ++p) {
+            char lowered[TLD_BENCH_MAX_PREFIX];
+            tld_fuzzy_pattern prepared = tld_fuzzy_make_pattern(patterns->patterns[p], lowered);
+            if (prepared.size == 0) continue;
+            
+            start = tld_bench_now_ns();
+            int32_t count = 0;
+            int32_t entries[TLD_FUZZY_BATCH_LANES];
+            tld_fuzzy_corpus_text texts[TLD_FUZZY_BATCH_LANES];
+            
+            for (int32_t i = 0; i <= corpus->count; ++i) {
+                if (i < corpus->count) {
+                    scores[i] = 0;
+                    if ((prepared.mask & ~corpus->char_masks[i]) != 0) continue;
+                    
+                    entries[count] = i;
+                    texts[count++] = tldui_fuzzy_corpus_text(corpus, i);
+                    if (count < TLD_FUZZY_BATCH_LANES) continue;
+                }
+                
+                int32_t lane_scores[TLD_FUZZY_BATCH_LANES];
+                tld_fuzzy_match_batch(&prepared, texts, count, 0, lane_scores);
+                for (int32_t lane = 0; lane < count; ++lane) {
+                    scores[entries[lane]] = lane_scores[lane];
+                }
+                count = 0;
+            }
+            batch_time += tld_bench_now_ns() - start;
+            
+            for (int32_t i = 0; i < corpus->count; ++i) {
+                tld_fuzzy_corpus_text text = tldui_fuzzy_corpus_text(corpus, i);
+                mismatches += (scores[i] != tld_fuzzy_match_text(&prepared, &text, 0));
+            }
+        }
+        
+        if (mismatches != 0) {
+            fprintf(stderr, "warning: %d batch scores differ from the corpus matcher\n", mismatches);
+        }
+        
+        *batch_ns = batch_time / candidates;
+        free(scores);
+    }
+#endif
+    
+    tld_fuzzy_scratch_free(&scratch);
+}
+
+static void
+tld_bench_run(const char *name, tld_bench_generator *generate, int32_t size) {
+    tldui_fuzzy_corpus corpus = {0};
+    if (!tld_bench_make_corpus(&corpus, generate, size, 0x9E3779B97F4A7C15ull ^ (uint64_t) size)) {
+        fprintf(stderr, "%s %d: out of memory\n", name, size);
+        tldui_fuzzy_corpus_free(&corpus);
+        return;
+    }
+    
+    uint64_t rng = 0xD1B54A32D192ED03ull ^ (uint64_t) size;
+    
+    tld_bench_patterns *patterns = (tld_bench_patterns *) malloc(sizeof(tld_bench_patterns));
+    int32_t max_keystrokes = TLD_BENCH_SCRIPT_COUNT * (3 * TLD_BENCH_MAX_PREFIX + 1);
+    uint64_t *latencies = (uint64_t *) malloc(sizeof(uint64_t) * max_keystrokes);
+    int32_t result_memory[2 * TLD_BENCH_RESULT_COUNT];
+    
+    if (patterns == 0 || latencies == 0) {
+        fprintf(stderr, "%s %d: out of memory\n", name, size);
+        free(patterns);
+        free(latencies);
+        tldui_fuzzy_corpus_free(&corpus);
+        return;
+    }
+    
+    double survivors[TLD_BENCH_MAX_PREFIX + 1] = {0};
+    int32_t survivor_samples[TLD_BENCH_MAX_PREFIX + 1] = {0};
+    int32_t keystrokes = 0;
+    
+    patterns->count = 0;
+    for (int32_t s = 0; s < TLD_BENCH_SCRIPT_COUNT; ++s) {
+        String target = tldui_fuzzy_corpus_get(&corpus, tld_bench_random(&rng) % corpus.count);
+        String abbreviation = tld_bench_make_abbreviation(target, &rng, patterns->space[s],
+                                                          TLD_BENCH_MAX_PREFIX);
+        patterns->patterns[patterns->count++] = abbreviation;
+        
+        // Type the abbreviation, taking back a few characters halfway through
+        char pattern_space[TLD_BENCH_MAX_PREFIX];
+        String pattern = make_fixed_width_string(pattern_space);
+        int32_t backspace_at = abbreviation.size / 2;
+        int32_t backspaces = (abbreviation.size > 3) ? 1 + tld_bench_random(&rng) % 2 : 0;
+        
+        tldui_survivor_stack stack = {0};
+        tldui_top_k results = tldui_make_top_k(result_memory, result_memory + TLD_BENCH_RESULT_COUNT,
+                                               TLD_BENCH_RESULT_COUNT);
+        
+        for (int32_t step = 0; step <= abbreviation.size + 2 * backspaces; ++step) {
+            if (step > 0) {
+                int32_t typed = step - 1;
+                if (typed >= backspace_at && typed < backspace_at + backspaces) {
+                    pattern.size -= 1;
+                } else {
+                    if (typed >= backspace_at + backspaces) {
+                        typed -= 2 * backspaces;
+                    }
+                    append_s_char(&pattern, abbreviation.str[typed]);
+                }
+            }
+            
+            uint64_t start = tld_bench_now_ns();
+            tldui_fuzzy_refine(&stack, &corpus, pattern, &results);
+            latencies[keystrokes++] = tld_bench_now_ns() - start;
+            
+            int32_t survivor_count = corpus.count;
+            if (stack.level_count > 0) {
+                survivor_count = stack.levels[stack.level_count - 1].count;
+            }
+            survivors[pattern.size] += survivor_count;
+            survivor_samples[pattern.size] += 1;
+        }
+        
+        tldui_survivor_stack_free(&stack);
+    }
+    
+    double ss_ns, corpus_ns, batch_ns;
+    tld_bench_measure_matchers(&corpus, patterns, &ss_ns, &corpus_ns, &batch_ns);
+    
+    qsort(latencies, keystrokes, sizeof(uint64_t), tld_bench_compare_u64);
+    printf("%-8s %8d %13.1f %13.1f %13.1f %6d %9.1f %9.1f %9.1f %9.1f\n",
+           name, size, ss_ns, corpus_ns, batch_ns, keystrokes,
+           tld_bench_percentile_us(latencies, keystrokes, 0.50),
+           tld_bench_percentile_us(latencies, keystrokes, 0.90),
+           tld_bench_percentile_us(latencies, keystrokes, 0.99),
+           tld_bench_percentile_us(latencies, keystrokes, 1.00));
+    
+    printf("  survivors per prefix:");
+    for (int32_t i = 1; i <= TLD_BENCH_MAX_PREFIX; ++i) {
+        if (survivor_samples[i] > 0) {
+            printf(" %d:%.0f", i, survivors[i] / survivor_samples[i]);
+        }
+    }
+    printf("\n");
+    
+    free(patterns);
+    free(latencies);
+    tldui_fuzzy_corpus_free(&corpus);
+}
+
+// 
+// Checks
+// 
+
+struct tld_bench_checker {
+    const char *name;
+    int32_t mismatches;
+};
+
+static void
+tld_bench_mismatch(tld_bench_checker *checker, const char *what, String pattern, String value,
+                   int32_t score, int32_t expected)
+{
+    if (checker->mismatches < 10) {
+        fprintf(stderr, "%s: %s scores \"%.*s\" against \"%.*s\" %d, expected %d\n",
+                checker->name, what, pattern.size, pattern.str, value.size, value.str,
+                score, expected);
+    }
+    checker->mismatches += 1;
+}
+
+// Half of the patterns pick their characters from a random entry, in order and
+// with a random case, so that they match it and its likes. The other half are
+// random characters that mostly don't match at all.
+static String
+tld_bench_make_check_pattern(tldui_fuzzy_corpus *corpus, int32_t size, uint64_t *rng, char *space) {
+    static const char characters[] = "abcdefghijklmnopqrstuvwxyz_/.";
+    String result = make_string_cap(space, 0, size);
+    
+    String target = tldui_fuzzy_corpus_get(corpus, tld_bench_random(rng) % corpus->count);
+    if (tld_bench_random(rng) % 2 && target.size >= size) {
+        for (int32_t j = 0; j < target.size && result.size < size; ++j) {
+            // Keeps each remaining character with the probability that leaves
+            // exactly enough of them
+            int32_t needed = size - result.size;
+            if (tld_bench_random(rng) % (target.size - j) >= (uint32_t) needed) continue;
+            
+            char c = target.str[j];
+            if (tld_bench_random(rng) % 4 == 0) {
+                c = char_is_lower(c) ? char_to_upper(c) : char_to_lower(c);
+            }
+            append_s_char(&result, c);
+        }
+    } else {
+        while (result.size < size) {
+            append_s_char(&result, characters[tld_bench_random(rng) % (ArrayCount(characters) - 1)]);
+        }
+    }
+    
+    return result;
+}
+
+// Scores every entry with the generic scalar matcher, and compares the other
+// scalar entry points, the character masks and, if SIMD is enabled, the batch
+// matcher to it. The batches take turns at every size from one entry to
+// TLD_FUZZY_BATCH_LANES, so that every lane count is used.
+static void
+tld_bench_check_matchers(tld_bench_checker *checker, tldui_fuzzy_corpus *corpus, String pattern,
+                         int32_t *scalar_states, int32_t *batch_states)
+{
+    char lowered[TLD_BENCH_MAX_PREFIX];
+    tld_fuzzy_pattern prepared = tld_fuzzy_make_pattern(pattern, lowered);
+    int32_t state_size = tld_fuzzy_state_size(TLD_BENCH_MAX_ENTRY);
+    
+    int32_t count = 0;
+    for (int32_t first = 0, batch = 0; first < corpus->count; first += count, ++batch) {
+        count = min(1 + batch % TLD_BENCH_CHECK_LANES, corpus->count - first);
+        int32_t expected[TLD_BENCH_CHECK_LANES];
+        
+        for (int32_t lane = 0; lane < count; ++lane) {
+            int32_t i = first + lane;
+            String value = tldui_fuzzy_corpus_get(corpus, i);
+            tld_fuzzy_corpus_text text = tldui_fuzzy_corpus_text(corpus, i);
+            int32_t *state = scalar_states + lane * state_size;
+            
+            expected[lane] = tld_fuzzy_match_impl<false, false>(&prepared, &text, 0, 0, 0);
+            
+            int32_t score = tld_fuzzy_match_ss(pattern, value, 0);
+            if (score != expected[lane]) {
+                tld_bench_mismatch(checker, "tld_fuzzy_match_ss", pattern, value, score, expected[lane]);
+            }
+            
+            score = tld_fuzzy_match_text(&prepared, &text, state);
+            if (score != expected[lane]) {
+                tld_bench_mismatch(checker, "tld_fuzzy_match_text", pattern, value, score, expected[lane]);
+            }
+            
+            if (expected[lane] > 0 && (prepared.mask & ~corpus->char_masks[i]) != 0) {
+                tld_bench_mismatch(checker, "the character mask", pattern, value, 0, expected[lane]);
+            }
+        }
+        
+#if TLD_FUZZY_BATCH_LANES
+        tld_fuzzy_corpus_text texts[TLD_FUZZY_BATCH_LANES];
+        int32_t *lane_states[TLD_FUZZY_BATCH_LANES];
+        int32_t scores[TLD_FUZZY_BATCH_LANES];
+        
+        for (int32_t lane = 0; lane < count; ++lane) {
+            texts[lane] = tldui_fuzzy_corpus_text(corpus, first + lane);
+            lane_states[lane] = batch_states + lane * state_size;
+        }
+        tld_fuzzy_match_batch(&prepared, texts, count, lane_states, scores);
+        
+        for (int32_t lane = 0; lane < count; ++lane) {
+            String value = tldui_fuzzy_corpus_get(corpus, first + lane);
+            if (scores[lane] != expected[lane]) {
+                tld_bench_mismatch(checker, "tld_fuzzy_match_batch", pattern, value,
+                                   scores[lane], expected[lane]);
+            } else if (expected[lane] > 0 &&
+                       memcmp(lane_states[lane], scalar_states + lane * state_size,
+                              sizeof(int32_t) * tld_fuzzy_state_size(value.size)) != 0)
+            {
+                tld_bench_mismatch(checker, "the state of tld_fuzzy_match_batch", pattern, value,
+                                   scores[lane], expected[lane]);
+            }
+        }
+#endif
+    }
+}
+
+// Types the pattern one character at a time, and compares the ranking
+// tldui_fuzzy_refine computes from the survivors of the previous keystroke to
+// one computed from scratch.
+static void
+tld_bench_check_refine(tld_bench_checker *checker, tldui_fuzzy_corpus *corpus, String pattern) {
+    int32_t result_memory[2 * TLD_BENCH_RESULT_COUNT];
+    int32_t expected_memory[2 * TLD_BENCH_RESULT_COUNT];
+    tldui_survivor_stack stack = {0};
+    
+    for (int32_t size = 1; size <= pattern.size; ++size) {
+        String prefix = make_string(pattern.str, size);
+        
+        tldui_top_k results = tldui_make_top_k(result_memory, result_memory + TLD_BENCH_RESULT_COUNT,
+                                               TLD_BENCH_RESULT_COUNT);
+        tldui_fuzzy_refine(&stack, corpus, prefix, &results);
+        
+        char lowered[TLD_BENCH_MAX_PREFIX];
+        tld_fuzzy_pattern prepared = tld_fuzzy_make_pattern(prefix, lowered);
+#ifdef TLDUI_TRANSPOSE_PATTERNS
+        prepared.transpositions = true;
+#endif
+        
+        tldui_top_k expected = tldui_make_top_k(expected_memory, expected_memory + TLD_BENCH_RESULT_COUNT,
+                                                TLD_BENCH_RESULT_COUNT);
+        for (int32_t i = 0; i < corpus->count; ++i) {
+            tld_fuzzy_corpus_text text = tldui_fuzzy_corpus_text(corpus, i);
+            int32_t score = tld_fuzzy_match_text(&prepared, &text, 0);
+            if (score > 0) {
+                tldui_top_k_insert(&expected, i, tldui_fuzzy_corpus_rank(corpus, i, score));
+            }
+        }
+        tldui_top_k_sort(&expected);
+        
+        bool32 same = (results.count == expected.count);
+        for (int32_t r = 0; same && r < results.count; ++r) {
+            same = (results.indices[r] == expected.indices[r] && results.scores[r] == expected.scores[r]);
+        }
+        if (!same) {
+            int32_t r = 0;
+            while (r < min(results.count, expected.count) &&
+                   results.indices[r] == expected.indices[r] && results.scores[r] == expected.scores[r])
+            {
+                ++r;
+            }
+            
+            // Reports the first result that differs, or the first missing one
+            int32_t index = (r < expected.count) ? expected.indices[r] : results.indices[r];
+            int32_t score = (r < results.count) ? results.scores[r] : 0;
+            tld_bench_mismatch(checker, "tldui_fuzzy_refine", prefix,
+                               tldui_fuzzy_corpus_get(corpus, index), score,
+                               (r < expected.count) ? expected.scores[r] : 0);
+        }
+    }
+    
+    tldui_survivor_stack_free(&stack);
+}
+
+static int32_t
+tld_bench_check(const char *name, tld_bench_generator *generate, int32_t size) {
+    tld_bench_checker checker = {name, 0};
+    
+    tldui_fuzzy_corpus corpus = {0};
+    if (!tld_bench_make_corpus(&corpus, generate, size, 0x9E3779B97F4A7C15ull ^ (uint64_t) size)) {
+        fprintf(stderr, "%s %d: out of memory\n", name, size);
+        tldui_fuzzy_corpus_free(&corpus);
+        return 1;
+    }
+    
+    int32_t states_size = (sizeof(int32_t) * TLD_BENCH_CHECK_LANES *
+                           tld_fuzzy_state_size(TLD_BENCH_MAX_ENTRY));
+    int32_t *scalar_states = (int32_t *) malloc(states_size);
+    int32_t *batch_states = (int32_t *) malloc(states_size);
+    if (scalar_states == 0 || batch_states == 0) {
+        fprintf(stderr, "%s %d: out of memory\n", name, size);
+        free(scalar_states);
+        free(batch_states);
+        tldui_fuzzy_corpus_free(&corpus);
+        return 1;
+    }
+    
+    uint64_t rng = 0xD1B54A32D192ED03ull ^ (uint64_t) size;
+    for (int32_t pattern_size = 1; pattern_size <= TLD_BENCH_CHECK_MAX_PATTERN; ++pattern_size) {
+        for (int32_t p = 0; p < TLD_BENCH_CHECK_PATTERN_COUNT; ++p) {
+            char pattern_space[TLD_BENCH_MAX_PREFIX];
+            String pattern = tld_bench_make_check_pattern(&corpus, pattern_size, &rng, pattern_space);
+            
+            tld_bench_check_matchers(&checker, &corpus, pattern, scalar_states, batch_states);
+            if (pattern_size == TLD_BENCH_CHECK_MAX_PATTERN) {
+                tld_bench_check_refine(&checker, &corpus, pattern);
+            }
+        }
+    }
+    
+    printf("%-8s %8d %s\n", name, size, (checker.mismatches == 0) ? "ok" : "MISMATCH");
+    
+    free(scalar_states);
+    free(batch_states);
+    tldui_fuzzy_corpus_free(&corpus);
+    return checker.mismatches;
+}
+
+int
+main(int argc, char **argv) {
+    int32_t default_sizes[] = {1000, 100000, 1000000};
+    int32_t sizes[32];
+    int32_t size_count = 0;
+    bool32 check = false;
+    
+    for (int32_t i = 1; i < argc && size_count < ArrayCount(sizes); ++i) {
+        if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+            continue;
+        }
+        
+        int32_t size = atoi(argv[i]);
+        if (size > 0) {
+            sizes[size_count++] = size;
+        }
+    }
+    
+    if (check) {
+        if (size_count == 0) {
+            sizes[size_count++] = 20000;
+        }
+        
+        printf("threads: %d, batch lanes: %d, patterns per length: %d\n",
+               tldui_worker_count(), TLD_FUZZY_BATCH_LANES, TLD_BENCH_CHECK_PATTERN_COUNT);
+        
+        int32_t mismatches = 0;
+        for (int32_t i = 0; i < size_count; ++i) {
+            mismatches += tld_bench_check("paths", tld_bench_make_path, sizes[i]);
+            mismatches += tld_bench_check("commands", tld_bench_make_command, sizes[i]);
+        }
+        
+        return (mismatches == 0) ? 0 : 1;
+    }
+    
+    if (size_count == 0) {
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+        size_count = ArrayCount(default_sizes);
+    }
+    
+    printf("threads: %d, batch lanes: %d, results per keystroke: %d, scripts per corpus: %d\n",
+           tldui_worker_count(), TLD_FUZZY_BATCH_LANES, TLD_BENCH_RESULT_COUNT,
+           TLD_BENCH_SCRIPT_COUNT);
+    printf("%-8s %8s %13s %13s %13s %6s %9s %9s %9s %9s\n", "corpus", "size",
+           "match_ss ns", "corpus ns", "batch ns", "keys", "p50 us", "p90 us", "p99 us", "max us");
+    
+    for (int32_t i = 0; i < size_count; ++i) {
+        tld_bench_run("paths", tld_bench_make_path, sizes[i]);
+        tld_bench_run("commands", tld_bench_make_command, sizes[i]);
+    }
+    
+    return 0;
+}
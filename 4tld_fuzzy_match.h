@@ -0,0 +1,2582 @@
+/******************************************************************************
+Author: Tristan Dannenberg
+Notice: No warranty is offered or implied; use this code at your own risk.
+*******************************************************************************
+LICENSE
+
+This software is dual-licensed to the public domain and under the following
+license: you are granted a perpetual, irrevocable license to copy, modify,
+publish, and distribute this file as you see fit.
+*******************************************************************************
+This file hosts the fuzzy matcher and the incremental ranking behind
+tldui_query_fuzzy_list. It only depends on 4coder_lib/4coder_string.h, so that
+it can be built without the rest of 4coder, see 4tld_fuzzy_bench.cpp.
+4tld_user_interface.h includes it, so command packs need not do so themselves.
+
+Preprocessor Variables:
+* TLD_FUZZY_MATCH_H is the include guard
+* TLDUI_MAX_PATTERN_SIZE is the longest pattern the fuzzy matcher keeps its
+  tables for on the stack. Longer patterns take their tables from a
+  tld_fuzzy_scratch. This also bounds the number of pattern lengths a fuzzy
+  list query keeps survivors for. This defaults to 64.
+* TLDUI_TRANSPOSE_PATTERNS is not defined by default. If this macro is defined,
+  tldui_query_fuzzy_list also accepts strings that match the pattern with
+  adjacent characters swapped, yielding larger result sets and resistance to
+  typos in the pattern. This is scored in the same pass as regular matches,
+  but typing can no longer resume from saved matcher states.
+* TLDUI_MAX_WORKER_COUNT is the maximum number of threads (including the one
+  that runs the pass) used to score large lists. This defaults to 8, or 1 on
+  Windows, where no thread pool is implemented yet. Set it to 1 to disable
+  threading, which also makes fuzzy list queries score in the UI thread.
+* TLDUI_PARALLEL_THRESHOLD is the minimum list size at which scoring is split
+  across threads. This defaults to 4096.
+* TLDUI_RESUME_MEMORY is the number of bytes each pattern length of a fuzzy
+  list query may spend on saved matcher states, which let the next keystroke
+  compute one table row per candidate instead of the whole table. This
+  defaults to 64MB.
+* TLDUI_FUZZY_CHUNK_SIZE is the number of candidates a fuzzy list query scores
+  in the background before it publishes its best matches so far and checks
+  whether the pattern has changed since. This defaults to 32768.
+* TLDUI_FUZZY_MEMO_SIZE is the number of bytes a tldui_fuzzy_memo may spend on
+  remembered result sets. This defaults to 256KB.
+* TLDUI_DISABLE_SIMD is not defined by default. Unless this macro is defined,
+  fuzzy list queries that have to score candidates from scratch score them 8
+  at a time with SSE2, or 16 at a time if the file is compiled with AVX2
+  enabled (e.g. -mavx2). The ranking is the same either way.
+******************************************************************************/
+#ifndef TLD_FUZZY_MATCH_H
+#define TLD_FUZZY_MATCH_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// 
+// Fuzzy String Matching
+// 
+
+#ifndef TLDUI_MAX_PATTERN_SIZE
+#define TLDUI_MAX_PATTERN_SIZE 64
+#endif
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+static inline b32_4tech
+tld_char_is_separator(char a) {
+    return (a == ' ' || a == '_' || a == '-' ||
+            a == '.' || a == '/' || a == '\\');
+}
+
+// Case folding of the letters of the Latin, Greek, Cyrillic and Armenian
+// alphabets that UTF-8 encodes in two bytes (leaving out historic and phonetic
+// ones), each of which folds to a letter that takes two bytes as well.
+// Folding thus never changes the size of a string, so lowered text still
+// lines up with the original byte by byte.
+constexpr uint32_t
+tld_fold_code_point(uint32_t c) {
+    return
+        // Latin-1 Supplement
+        (c == 0xB5) ? 0x3BC :
+        (c >= 0xC0 && c <= 0xDE && c != 0xD7) ? c + 0x20 :
+        
+        // Latin Extended-A
+        ((c >= 0x100 && c <= 0x12F) || (c >= 0x132 && c <= 0x137) ||
+         (c >= 0x14A && c <= 0x177)) ? (c | 1) :
+        ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) ? c + (c & 1) :
+        (c == 0x178) ? 0xFF :
+        
+        // Latin Extended-B
+        (c == 0x1C4 || c == 0x1C5) ? 0x1C6 :
+        (c == 0x1C7 || c == 0x1C8) ? 0x1C9 :
+        (c == 0x1CA || c == 0x1CB) ? 0x1CC :
+        (c == 0x1F1 || c == 0x1F2) ? 0x1F3 :
+        (c >= 0x1CD && c <= 0x1DC) ? c + (c & 1) :
+        ((c >= 0x1DE && c <= 0x1EF) || c == 0x1F4 || (c >= 0x1F8 && c <= 0x21F) ||
+         (c >= 0x222 && c <= 0x233) || (c >= 0x246 && c <= 0x24F)) ? (c | 1) :
+        
+        // Greek
+        (c == 0x386) ? 0x3AC :
+        (c >= 0x388 && c <= 0x38A) ? c + 0x25 :
+        (c == 0x38C) ? 0x3CC :
+        (c == 0x38E || c == 0x38F) ? c + 0x3F :
+        (c >= 0x391 && c <= 0x3AB && c != 0x3A2) ? c + 0x20 :
+        (c == 0x3C2) ? 0x3C3 :
+        (c >= 0x3D8 && c <= 0x3EF) ? (c | 1) :
+        
+        // Cyrillic
+        (c >= 0x400 && c <= 0x40F) ? c + 0x50 :
+        (c >= 0x410 && c <= 0x42F) ? c + 0x20 :
+        ((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) ||
+         (c >= 0x4D0 && c <= 0x52F)) ? (c | 1) :
+        (c == 0x4C0) ? 0x4CF :
+        (c >= 0x4C1 && c <= 0x4CE) ? c + (c & 1) :
+        
+        // Armenian
+        (c >= 0x531 && c <= 0x556) ? c + 0x30 :
+        c;
+}
+
+#define TLD_FOLD_4(c) tld_fold_code_point(c), tld_fold_code_point((c) + 1), \
+    tld_fold_code_point((c) + 2), tld_fold_code_point((c) + 3)
+#define TLD_FOLD_16(c) TLD_FOLD_4(c), TLD_FOLD_4((c) + 4), TLD_FOLD_4((c) + 8), TLD_FOLD_4((c) + 12)
+#define TLD_FOLD_64(c) TLD_FOLD_16(c), TLD_FOLD_16((c) + 16), TLD_FOLD_16((c) + 32), TLD_FOLD_16((c) + 48)
+#define TLD_FOLD_256(c) TLD_FOLD_64(c), TLD_FOLD_64((c) + 64), TLD_FOLD_64((c) + 128), TLD_FOLD_64((c) + 192)
+
+// Indexed by code point, so the first 128 entries are never read
+static constexpr uint16_t tld_fold_table[0x800] = {
+    TLD_FOLD_256(0x000), TLD_FOLD_256(0x100), TLD_FOLD_256(0x200), TLD_FOLD_256(0x300),
+    TLD_FOLD_256(0x400), TLD_FOLD_256(0x500), TLD_FOLD_256(0x600), TLD_FOLD_256(0x700),
+};
+
+#undef TLD_FOLD_256
+#undef TLD_FOLD_64
+#undef TLD_FOLD_16
+#undef TLD_FOLD_4
+
+static char
+tld_fuzzy_lower_utf8(String val, int32_t j) {
+    uint8_t c = (uint8_t) val.str[j];
+    
+    // A continuation byte is folded along with the lead byte before it
+    int32_t lead = j;
+    if (c < 0xC0) {
+        if (j == 0) return c;
+        lead = j - 1;
+    }
+    
+    uint8_t b0 = (uint8_t) val.str[lead];
+    if (b0 < 0xC2 || b0 > 0xDF || lead + 1 >= val.size) return c;
+    
+    uint8_t b1 = (uint8_t) val.str[lead + 1];
+    if ((b1 & 0xC0) != 0x80) return c;
+    
+    uint32_t folded = tld_fold_table[((b0 & 0x1F) << 6) | (b1 & 0x3F)];
+    return (char)((lead == j) ? (0xC0 | (folded >> 6)) : (0x80 | (folded & 0x3F)));
+}
+
+// The byte at index j of the case folded string. Only non-ASCII bytes have to
+// look at their neighbours.
+static inline char
+tld_fuzzy_lower(String val, int32_t j) {
+    char c = val.str[j];
+    if ((uint8_t) c < 0x80) return char_to_lower(c);
+    return tld_fuzzy_lower_utf8(val, j);
+}
+
+// ASCII only, see tld_fuzzy_lower for strings
+static inline b32_4tech
+tld_fuzzy_match_char(char a, char b) {
+    return ((char_to_lower(a) == char_to_lower(b)) ||
+            (a == ' ' && tld_char_is_separator(b)));
+}
+
+static inline b32_4tech
+tld_fuzzy_is_word_start(String val, int32_t j) {
+    return (j == 0 || (char_is_lower(val.str[j - 1]) && char_is_upper(val.str[j])) ||
+            tld_char_is_separator(val.str[j - 1]));
+}
+
+// Maps a character to its bit in a character mask. Letters and digits get a
+// bit each (case-insensitively), every separator gets its own bit, everything
+// else shares a handful of bits. Since tld_fuzzy_match_char lets a space in the
+// pattern match any separator, separators in a value additionally set bit 42,
+// which is the only bit a space in the pattern requires.
+static inline uint64_t
+tld_fuzzy_char_bit(char c) {
+    uint8_t u = (uint8_t) char_to_lower(c);
+    
+    if (u >= 'a' && u <= 'z') return 1ull << (u - 'a');
+    if (u >= '0' && u <= '9') return 1ull << (26 + u - '0');
+    if (u >= 0x80)            return 1ull << 63;
+    
+    switch (u) {
+        case ' ':  return (1ull << 36) | (1ull << 42);
+        case '_':  return (1ull << 37) | (1ull << 42);
+        case '-':  return (1ull << 38) | (1ull << 42);
+        case '.':  return (1ull << 39) | (1ull << 42);
+        case '/':  return (1ull << 40) | (1ull << 42);
+        case '\\': return (1ull << 41) | (1ull << 42);
+    }
+    
+    return 1ull << (43 + u % 20);
+}
+
+// The set of characters occurring in a value; a pattern can only match a value
+// if tld_fuzzy_pattern_mask(pattern) is a subset of this.
+static inline uint64_t
+tld_fuzzy_char_mask(String val) {
+    uint64_t result = 0;
+    for (int32_t i = 0; i < val.size; ++i) {
+        result |= tld_fuzzy_char_bit(val.str[i]);
+    }
+    return result;
+}
+
+static inline uint64_t
+tld_fuzzy_pattern_mask(String pattern) {
+    uint64_t result = 0;
+    for (int32_t i = 0; i < pattern.size; ++i) {
+        if (pattern.str[i] == ' ') {
+            result |= 1ull << 42;
+        } else {
+            result |= tld_fuzzy_char_bit(pattern.str[i]);
+        }
+    }
+    return result;
+}
+
+// A pattern prepared for matching, so that it is lowered once per query
+// rather than once per table cell.
+// Patterns longer than TLDUI_MAX_PATTERN_SIZE need rows, with room for
+// tld_fuzzy_rows_size(size) bytes, which the matcher keeps its tables in.
+// Such a pattern must not be matched on two threads at once.
+// If transpositions is set, two adjacent pattern characters also match the
+// same two characters in swapped order.
+struct tld_fuzzy_pattern {
+    char *lowered;
+    int32_t size;
+    uint64_t mask;
+    int32_t *rows;
+    bool32 transpositions;
+};
+
+static inline int32_t
+tld_fuzzy_rows_size(int32_t pattern_size) {
+    return (pattern_size > TLDUI_MAX_PATTERN_SIZE) ? 3 * pattern_size * (int32_t) sizeof(int32_t) : 0;
+}
+
+// Reusable memory for long patterns. It only ever grows, so a scratch that is
+// kept across keystrokes stops allocating once it has seen the longest
+// pattern, and matching itself never allocates.
+struct tld_fuzzy_scratch {
+    void *memory;
+    int32_t capacity;
+};
+
+// Returns at least size bytes, or 0 if they couldn't be allocated.
+// Previous contents are not preserved.
+static void *
+tld_fuzzy_scratch_reserve(tld_fuzzy_scratch *scratch, int32_t size) {
+    if (scratch->capacity < size) {
+        int32_t capacity = max(size, 2 * scratch->capacity);
+        void *memory = malloc(capacity);
+        if (memory == 0) return 0;
+        
+        free(scratch->memory);
+        scratch->memory = memory;
+        scratch->capacity = capacity;
+    }
+    
+    return scratch->memory;
+}
+
+static inline void
+tld_fuzzy_scratch_free(tld_fuzzy_scratch *scratch) {
+    free(scratch->memory);
+    scratch->memory = 0;
+    scratch->capacity = 0;
+}
+
+// Space must have room for pattern.size characters.
+static inline tld_fuzzy_pattern
+tld_fuzzy_make_pattern(String pattern, char *space) {
+    tld_fuzzy_pattern result;
+    result.lowered = space;
+    result.size = pattern.size;
+    result.mask = tld_fuzzy_pattern_mask(pattern);
+    result.rows = 0;
+    result.transpositions = false;
+    
+    for (int32_t i = 0; i < pattern.size; ++i) {
+        space[i] = tld_fuzzy_lower(pattern, i);
+    }
+    
+    return result;
+}
+
+// The matcher reads values through one of these. tld_fuzzy_raw_text works on
+// plain strings and classifies characters on the fly, tld_fuzzy_corpus_text
+// reads the lowered text and character classes precomputed by a
+// tldui_fuzzy_corpus.
+struct tld_fuzzy_raw_text {
+    String val;
+    int32_t size;
+};
+
+static inline char
+tld_text_lower(tld_fuzzy_raw_text *text, int32_t j) {
+    return tld_fuzzy_lower(text->val, j);
+}
+
+static inline b32_4tech
+tld_text_is_separator(tld_fuzzy_raw_text *text, int32_t j) {
+    return tld_char_is_separator(text->val.str[j]);
+}
+
+static inline b32_4tech
+tld_text_is_word_start(tld_fuzzy_raw_text *text, int32_t j) {
+    return tld_fuzzy_is_word_start(text->val, j);
+}
+
+struct tld_fuzzy_corpus_text {
+    char *lowered;
+    uint8_t *separators;
+    uint8_t *word_starts;
+    uint32_t base;
+    int32_t size;
+};
+
+static inline char
+tld_text_lower(tld_fuzzy_corpus_text *text, int32_t j) {
+    return text->lowered[j];
+}
+
+static inline b32_4tech
+tld_text_is_separator(tld_fuzzy_corpus_text *text, int32_t j) {
+    uint32_t bit = text->base + j;
+    return (text->separators[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static inline b32_4tech
+tld_text_is_word_start(tld_fuzzy_corpus_text *text, int32_t j) {
+    uint32_t bit = text->base + j;
+    return (text->word_starts[bit >> 3] >> (bit & 7)) & 1;
+}
+
+// Same as tld_fuzzy_match_char, for a lowered pattern character
+template <typename Text>
+static inline b32_4tech
+tld_text_match(Text *text, int32_t j, char p) {
+    return (tld_text_lower(text, j) == p) | ((p == ' ') & tld_text_is_separator(text, j));
+}
+
+// The number of uint64_t the matcher needs to trace the best match of a
+// pattern in a value of the given lengths.
+static inline int32_t
+tld_fuzzy_trace_size(int32_t pattern_size, int32_t val_size) {
+    return 2 * val_size * ((pattern_size + 63) / 64);
+}
+
+// The number of int32_t a saved matcher state takes up for a value of the
+// given length.
+static inline int32_t
+tld_fuzzy_state_size(int32_t val_size) {
+    return 1 + 2 * val_size;
+}
+
+// This is where the magic happens
+// 
+// With Transpositions, a third row remembers the diagonal each cell of the
+// previous column was computed from, which is the cell two rows up and two
+// columns left of the cell below it in the current one. A pair of pattern
+// characters found swapped in the value continues from there, adding 1 to
+// the score, which is less than any two characters matched in order would.
+// 
+// With Trace, every cell whose score came from a match (or a swapped pair)
+// sets its bit in the trace, which is then followed back from the last cell
+// to find the positions of the best alignment.
+template <bool32 Transpositions, bool32 Trace, typename Text>
+static int32_t
+tld_fuzzy_match_impl(tld_fuzzy_pattern *pattern, Text *val, int32_t *state,
+                     uint64_t *trace, uint64_t *positions)
+{
+    Assert(pattern->size <= TLDUI_MAX_PATTERN_SIZE || pattern->rows);
+    Assert(!Transpositions || state == 0);
+    
+    int32_t trace_words = (pattern->size + 63) / 64;
+    if (Trace) {
+        memset(trace, 0, sizeof(uint64_t) * tld_fuzzy_trace_size(pattern->size, val->size));
+        memset(positions, 0, sizeof(uint64_t) * ((val->size + 63) / 64));
+    }
+    
+    // Optimization 1: Skip table rows
+    int j = 0;
+    while (j < val->size && !tld_text_match(val, j, pattern->lowered[0])) {
+        if (Transpositions && pattern->size > 1 && tld_text_match(val, j, pattern->lowered[1])) {
+            break;
+        }
+        j++;
+    }
+    
+    if (val->size - j < pattern->size) {
+        return 0;
+    }
+    
+    int32_t row_space[3 * TLDUI_MAX_PATTERN_SIZE];
+    int32_t *row = row_space; // Current row of scores table
+    if (pattern->size > TLDUI_MAX_PATTERN_SIZE) {
+        row = pattern->rows;
+    }
+    
+    int32_t *lml = row + pattern->size; // Current row of auxiliary table (match lengths)
+    int32_t *swp = lml + pattern->size; // Diagonals of the previous column
+    memset(row, 0, sizeof(int32_t) * (Transpositions ? 3 : 2) * pattern->size);
+    
+    int j_lo = j;
+    int32_t *last_row = 0;
+    int32_t *last_lml = 0;
+    
+    if (state) {
+        state[0] = j_lo;
+        last_row = state + 1;
+        last_lml = last_row + val->size;
+        
+        for (int k = 0; k < j_lo; ++k) {
+            last_row[k] = 0;
+            last_lml[k] = 0;
+        }
+    }
+    
+    for (; j < val->size; ++j) {
+        int32_t diag = 1;
+        int32_t diag_l = 0;
+        
+        // Optimization 2: Skip triangular table sections that don't affect the result
+        int i_lo = max(j + pattern->size - val->size, 0);
+        int i_hi = min(j - j_lo + 1, pattern->size);
+        
+        int32_t swap_diag = 0;
+        int32_t match_above = 0;
+        
+        if (i_lo > 0) {
+            diag = row[i_lo - 1];
+            diag_l = lml[i_lo - 1];
+            
+            if (Transpositions) {
+                swap_diag = swp[i_lo - 1];
+                match_above = tld_text_match(val, j, pattern->lowered[i_lo - 1]);
+            }
+        }
+        
+        if (Transpositions) {
+            // A swapped pair ending in the last row tested needs to know
+            // whether that row matched the previous character
+            i_hi = min(i_hi + 1, pattern->size);
+        }
+        
+        // Abbreviation bonus:
+        int32_t bonus = tld_text_is_word_start(val, j) ? 4 : 0;
+        
+        uint64_t *matched = Trace ? trace + 2 * trace_words * j : 0;
+        uint64_t *swapped = Trace ? matched + trace_words : 0;
+        
+        for (int i = i_lo; i < i_hi; ++i) {
+            int32_t row_old = row[i];
+            int32_t lml_old = lml[i];
+            
+            int32_t match = tld_text_match(val, j, pattern->lowered[i]);
+            lml[i] = match * (diag_l + 1);
+            
+            if (diag > 0 && match) {
+                // Sequential match bonus:
+                int32_t value = diag + lml[i] + bonus;
+                if (value > row[i]) {
+                    row[i] = value;
+                    if (Trace) matched[i / 64] |= 1ull << (i % 64);
+                }
+            }
+            
+            if (Transpositions) {
+                // This character matched the previous column, and the one
+                // above it matches this one
+                if (swap_diag > 0 && match_above && lml_old > 0 && swap_diag + 1 > row[i]) {
+                    row[i] = swap_diag + 1;
+                    if (Trace) {
+                        matched[i / 64] &= ~(1ull << (i % 64));
+                        swapped[i / 64] |= 1ull << (i % 64);
+                    }
+                }
+                
+                swap_diag = swp[i];
+                swp[i] = diag;
+                match_above = match;
+            }
+            
+            diag = row_old;
+            diag_l = lml_old;
+        }
+        
+        if (last_row) {
+            last_row[j] = row[pattern->size - 1];
+            last_lml[j] = lml[pattern->size - 1];
+        }
+    }
+    
+    int32_t score = row[pattern->size - 1];
+    
+    if (Trace && score > 0) {
+        int32_t i = pattern->size - 1;
+        j = val->size - 1;
+        
+        while (i >= 0) {
+            uint64_t *matched = trace + 2 * trace_words * j;
+            uint64_t *swapped = matched + trace_words;
+            uint64_t bit = 1ull << (i % 64);
+            
+            if (matched[i / 64] & bit) {
+                positions[j / 64] |= 1ull << (j % 64);
+                i -= 1;
+                j -= 1;
+            } else if (Transpositions && (swapped[i / 64] & bit)) {
+                positions[j / 64] |= 1ull << (j % 64);
+                positions[(j - 1) / 64] |= 1ull << ((j - 1) % 64);
+                i -= 2;
+                j -= 2;
+            } else {
+                j -= 1;
+            }
+        }
+    }
+    
+    return score;
+}
+
+// The common case of tld_fuzzy_match_impl, short patterns matched without
+// transpositions or tracing, instantiated for every pattern size up to 8,
+// see tld_fuzzy_match_text. With the size known at compile time, the loop
+// over the pattern can be unrolled and the table rows kept in registers. Every
+// column is computed in full, which costs less than bounding it to the band
+// that tld_fuzzy_match_impl computes: cells outside of that band never
+// influence the cells inside of it, so the score is the same, and so is the
+// saved state, once the cells left of the band are cleared.
+template <int32_t Size, typename Text>
+static int32_t
+tld_fuzzy_match_fixed(tld_fuzzy_pattern *pattern, Text *val, int32_t *state) {
+    Assert(pattern->size == Size);
+    
+    int j = 0;
+    while (j < val->size && !tld_text_match(val, j, pattern->lowered[0])) {
+        j++;
+    }
+    
+    if (val->size - j < Size) {
+        return 0;
+    }
+    
+    char p[Size];
+    int32_t space[Size];
+    int32_t row[Size];
+    int32_t lml[Size];
+    for (int i = 0; i < Size; ++i) {
+        p[i] = pattern->lowered[i];
+        space[i] = (p[i] == ' ');
+        row[i] = 0;
+        lml[i] = 0;
+    }
+    
+    int j_lo = j;
+    int32_t *last_row = 0;
+    int32_t *last_lml = 0;
+    
+    if (state) {
+        state[0] = j_lo;
+        last_row = state + 1;
+        last_lml = last_row + val->size;
+        
+        for (int k = 0; k < j_lo; ++k) {
+            last_row[k] = 0;
+            last_lml[k] = 0;
+        }
+    }
+    
+    for (; j < val->size; ++j) {
+        char c = tld_text_lower(val, j);
+        int32_t separator = tld_text_is_separator(val, j);
+        int32_t bonus = tld_text_is_word_start(val, j) ? 4 : 0;
+        
+        int32_t diag = 1;
+        int32_t diag_l = 0;
+        
+        for (int i = 0; i < Size; ++i) {
+            int32_t row_old = row[i];
+            int32_t lml_old = lml[i];
+            
+            int32_t match = (c == p[i]) | (space[i] & separator);
+            lml[i] = match * (diag_l + 1);
+            
+            int32_t value = diag + lml[i] + bonus;
+            if ((diag > 0) & match & (value > row_old)) {
+                row[i] = value;
+            }
+            
+            diag = row_old;
+            diag_l = lml_old;
+        }
+        
+        if (last_row) {
+            // The last row is only in the band from here on
+            bool32 in_band = (j >= j_lo + Size - 1);
+            last_row[j] = row[Size - 1];
+            last_lml[j] = in_band ? lml[Size - 1] : 0;
+        }
+    }
+    
+    return row[Size - 1];
+}
+
+// If state is not 0, the last row of the tables is saved there, so that
+// tld_fuzzy_resume_text can pick up from it once the pattern grows. It must
+// have room for tld_fuzzy_state_size(val->size) values, and is left untouched
+// if the pattern cannot match. Patterns with transpositions cannot be resumed,
+// and must be matched without a state.
+template <typename Text>
+static int32_t
+tld_fuzzy_match_text(tld_fuzzy_pattern *pattern, Text *val, int32_t *state) {
+    if (pattern->size == 0) {
+        return 1;
+    }
+    
+    if (pattern->transpositions) {
+        return tld_fuzzy_match_impl<true, false>(pattern, val, state, 0, 0);
+    }
+    
+    // Short patterns are by far the most common
+    switch (pattern->size) {
+        case 1: return tld_fuzzy_match_fixed<1>(pattern, val, state);
+        case 2: return tld_fuzzy_match_fixed<2>(pattern, val, state);
+        case 3: return tld_fuzzy_match_fixed<3>(pattern, val, state);
+        case 4: return tld_fuzzy_match_fixed<4>(pattern, val, state);
+        case 5: return tld_fuzzy_match_fixed<5>(pattern, val, state);
+        case 6: return tld_fuzzy_match_fixed<6>(pattern, val, state);
+        case 7: return tld_fuzzy_match_fixed<7>(pattern, val, state);
+        case 8: return tld_fuzzy_match_fixed<8>(pattern, val, state);
+    }
+    
+    return tld_fuzzy_match_impl<false, false>(pattern, val, state, 0, 0);
+}
+
+// Like tld_fuzzy_match_text, but also sets bit j of positions for every
+// character j of the value that is part of the best match. Positions must have
+// room for (val->size + 63) / 64 words, trace for
+// tld_fuzzy_trace_size(pattern->size, val->size) words.
+template <typename Text>
+static int32_t
+tld_fuzzy_match_positions_text(tld_fuzzy_pattern *pattern, Text *val,
+                               uint64_t *trace, uint64_t *positions)
+{
+    if (pattern->size == 0) {
+        memset(positions, 0, sizeof(uint64_t) * ((val->size + 63) / 64));
+        return 1;
+    }
+    
+    if (pattern->transpositions) {
+        return tld_fuzzy_match_impl<true, true>(pattern, val, 0, trace, positions);
+    }
+    
+    return tld_fuzzy_match_impl<false, true>(pattern, val, 0, trace, positions);
+}
+
+// Scores a pattern that is one character longer than the one the state was
+// saved for, computing only the table row of the new character. This yields
+// the same score as tld_fuzzy_match_text, and updates the state in place for
+// the next character. The state is meaningless once the score is 0.
+template <typename Text>
+static int32_t
+tld_fuzzy_resume_text(tld_fuzzy_pattern *pattern, Text *val, int32_t *state) {
+    Assert(pattern->size >= 2);
+    
+    int32_t i = pattern->size - 1;
+    int32_t j_lo = state[0];
+    
+    if (val->size - j_lo < pattern->size) {
+        return 0;
+    }
+    
+    int32_t *last_row = state + 1;
+    int32_t *last_lml = last_row + val->size;
+    char p = pattern->lowered[i];
+    
+    // Cells left of j_lo + i are skipped by tld_fuzzy_match_text as well
+    int32_t j = j_lo + i;
+    int32_t diag = last_row[j - 1];
+    int32_t diag_l = last_lml[j - 1];
+    
+    int32_t row = 0;
+    int32_t lml = 0;
+    
+    for (; j < val->size; ++j) {
+        int32_t row_old = last_row[j];
+        int32_t lml_old = last_lml[j];
+        
+        int32_t match = tld_text_match(val, j, p);
+        lml = match * (diag_l + 1);
+        
+        if (diag > 0 && match) {
+            int32_t value = lml + (tld_text_is_word_start(val, j) ? 4 : 0);
+            row = max(diag + value, row);
+        }
+        
+        last_row[j] = row;
+        last_lml[j] = lml;
+        
+        diag = row_old;
+        diag_l = lml_old;
+    }
+    
+    for (j = 0; j < j_lo + i; ++j) {
+        last_row[j] = 0;
+        last_lml[j] = 0;
+    }
+    
+    return row;
+}
+
+// 
+// Batched Matching
+// 
+
+// No score of a pattern this long comes close to overflowing a 16 bit lane
+#define TLD_FUZZY_BATCH_MAX_PATTERN_SIZE 64
+#define TLD_FUZZY_BATCH_WINDOW 64
+
+#if !defined(TLDUI_DISABLE_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define TLD_FUZZY_BATCH_LANES 16
+
+typedef __m256i tld_lanes;
+#define tld_lanes_zero() _mm256_setzero_si256()
+#define tld_lanes_set1(a) _mm256_set1_epi16(a)
+#define tld_lanes_load(p) _mm256_loadu_si256((__m256i *)(p))
+#define tld_lanes_store(p, a) _mm256_storeu_si256((__m256i *)(p), a)
+#define tld_lanes_add(a, b) _mm256_add_epi16(a, b)
+#define tld_lanes_and(a, b) _mm256_and_si256(a, b)
+#define tld_lanes_or(a, b) _mm256_or_si256(a, b)
+#define tld_lanes_max(a, b) _mm256_max_epi16(a, b)
+#define tld_lanes_equal(a, b) _mm256_cmpeq_epi16(a, b)
+#define tld_lanes_greater(a, b) _mm256_cmpgt_epi16(a, b)
+#elif !defined(TLDUI_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define TLD_FUZZY_BATCH_LANES 8
+
+typedef __m128i tld_lanes;
+#define tld_lanes_zero() _mm_setzero_si128()
+#define tld_lanes_set1(a) _mm_set1_epi16(a)
+#define tld_lanes_load(p) _mm_loadu_si128((__m128i *)(p))
+#define tld_lanes_store(p, a) _mm_storeu_si128((__m128i *)(p), a)
+#define tld_lanes_add(a, b) _mm_add_epi16(a, b)
+#define tld_lanes_and(a, b) _mm_and_si128(a, b)
+#define tld_lanes_or(a, b) _mm_or_si128(a, b)
+#define tld_lanes_max(a, b) _mm_max_epi16(a, b)
+#define tld_lanes_equal(a, b) _mm_cmpeq_epi16(a, b)
+#define tld_lanes_greater(a, b) _mm_cmpgt_epi16(a, b)
+#else
+#define TLD_FUZZY_BATCH_LANES 0
+#endif
+
+#if TLD_FUZZY_BATCH_LANES
+// Scores up to TLD_FUZZY_BATCH_LANES strings of a corpus at once, one per lane,
+// with the same results as tld_fuzzy_match_text. The pattern must not be empty
+// and must be matched without transpositions.
+// 
+// Rather than skipping to the first match and pruning the table, every column
+// of every lane is computed in full; the cells this adds never affect those
+// tld_fuzzy_match_text computes. Lanes whose string has ended stop matching,
+// which leaves their scores unchanged. If states is not 0, every lane with a
+// state gets the one tld_fuzzy_match_text would save, if its string matches.
+static void
+tld_fuzzy_match_batch(tld_fuzzy_pattern *pattern, tld_fuzzy_corpus_text *texts, int32_t count,
+                      int32_t **states, int32_t *scores)
+{
+    Assert(count <= TLD_FUZZY_BATCH_LANES);
+    Assert(pattern->size > 0 && pattern->size <= TLD_FUZZY_BATCH_MAX_PATTERN_SIZE);
+    Assert(!pattern->transpositions);
+    
+    int32_t size = pattern->size;
+    int32_t max_size = 0;
+    int32_t band_start[TLD_FUZZY_BATCH_LANES];
+    
+    for (int32_t lane = 0; lane < count; ++lane) {
+        tld_fuzzy_corpus_text *text = &texts[lane];
+        max_size = max(max_size, text->size);
+        
+        if (states && states[lane]) {
+            // The last row enters the band size - 1 columns after the first
+            // match of the pattern's first character
+            int32_t j = 0;
+            while (j < text->size && !tld_text_match(text, j, pattern->lowered[0])) {
+                j++;
+            }
+            
+            states[lane][0] = j;
+            band_start[lane] = j + size - 1;
+        }
+    }
+    
+    tld_lanes p[TLD_FUZZY_BATCH_MAX_PATTERN_SIZE];
+    tld_lanes row[TLD_FUZZY_BATCH_MAX_PATTERN_SIZE];
+    tld_lanes lml[TLD_FUZZY_BATCH_MAX_PATTERN_SIZE];
+    bool32 has_space = false;
+    for (int32_t i = 0; i < size; ++i) {
+        p[i] = tld_lanes_set1((uint8_t) pattern->lowered[i]);
+        row[i] = tld_lanes_zero();
+        lml[i] = tld_lanes_zero();
+        has_space |= (pattern->lowered[i] == ' ');
+    }
+    
+    tld_lanes zero = tld_lanes_zero();
+    tld_lanes one = tld_lanes_set1(1);
+    tld_lanes space = tld_lanes_set1(' ');
+    
+    // The characters of each lane are read a window of columns at a time, and
+    // its last table row is saved the same way. Columns past the end of a
+    // string hold a character no pattern character is equal to.
+    int16_t characters[TLD_FUZZY_BATCH_WINDOW][TLD_FUZZY_BATCH_LANES];
+    int16_t separators[TLD_FUZZY_BATCH_WINDOW][TLD_FUZZY_BATCH_LANES];
+    int16_t bonuses[TLD_FUZZY_BATCH_WINDOW][TLD_FUZZY_BATCH_LANES];
+    int16_t last_rows[TLD_FUZZY_BATCH_WINDOW][TLD_FUZZY_BATCH_LANES];
+    int16_t last_lmls[TLD_FUZZY_BATCH_WINDOW][TLD_FUZZY_BATCH_LANES];
+    
+    for (int32_t window = 0; window < max_size; window += TLD_FUZZY_BATCH_WINDOW) {
+        int32_t window_size = min(max_size - window, TLD_FUZZY_BATCH_WINDOW);
+        
+        for (int32_t lane = 0; lane < TLD_FUZZY_BATCH_LANES; ++lane) {
+            int32_t end = 0;
+            if (lane < count) {
+                tld_fuzzy_corpus_text *text = &texts[lane];
+                end = min(max(text->size - window, 0), window_size);
+                
+                for (int32_t j = 0; j < end; ++j) {
+                    characters[j][lane] = (uint8_t) tld_text_lower(text, window + j);
+                    separators[j][lane] = -(int16_t) tld_text_is_separator(text, window + j);
+                    bonuses[j][lane] = tld_text_is_word_start(text, window + j) ? 4 : 0;
+                }
+            }
+            
+            for (int32_t j = end; j < window_size; ++j) {
+                characters[j][lane] = 0x100;
+                separators[j][lane] = 0;
+                bonuses[j][lane] = 0;
+            }
+        }
+        
+        for (int32_t j = 0; j < window_size; ++j) {
+            tld_lanes c = tld_lanes_load(characters[j]);
+            tld_lanes separator = tld_lanes_load(separators[j]);
+            tld_lanes bonus = tld_lanes_load(bonuses[j]);
+            
+            tld_lanes diag = one;
+            tld_lanes diag_l = zero;
+            
+            for (int32_t i = 0; i < size; ++i) {
+                tld_lanes row_old = row[i];
+                tld_lanes lml_old = lml[i];
+                
+                tld_lanes match = tld_lanes_equal(c, p[i]);
+                if (has_space) {
+                    match = tld_lanes_or(match, tld_lanes_and(separator, tld_lanes_equal(p[i], space)));
+                }
+                
+                lml[i] = tld_lanes_and(match, tld_lanes_add(diag_l, one));
+                
+                tld_lanes value = tld_lanes_add(tld_lanes_add(diag, lml[i]), bonus);
+                tld_lanes scored = tld_lanes_and(match, tld_lanes_greater(diag, zero));
+                row[i] = tld_lanes_max(row_old, tld_lanes_and(value, scored));
+                
+                diag = row_old;
+                diag_l = lml_old;
+            }
+            
+            tld_lanes_store(last_rows[j], row[size - 1]);
+            tld_lanes_store(last_lmls[j], lml[size - 1]);
+        }
+        
+        if (states) {
+            for (int32_t lane = 0; lane < count; ++lane) {
+                int32_t *state = states[lane];
+                if (state == 0) continue;
+                
+                int32_t text_size = texts[lane].size;
+                int32_t end = min(max(text_size - window, 0), window_size);
+                for (int32_t j = 0; j < end; ++j) {
+                    state[1 + window + j] = last_rows[j][lane];
+                    state[1 + text_size + window + j] =
+                        (window + j >= band_start[lane]) ? last_lmls[j][lane] : 0;
+                }
+            }
+        }
+    }
+    
+    tld_lanes_store(last_rows[0], row[size - 1]);
+    for (int32_t lane = 0; lane < count; ++lane) {
+        scores[lane] = last_rows[0][lane];
+    }
+}
+#endif
+
+// Patterns longer than TLDUI_MAX_PATTERN_SIZE are matched using the scratch.
+// If there is none, or it cannot grow, only the first TLDUI_MAX_PATTERN_SIZE
+// characters of the pattern are matched.
+static int32_t
+tld_fuzzy_match_ss(String pattern, String val, tld_fuzzy_scratch *scratch) {
+    char lowered_space[TLDUI_MAX_PATTERN_SIZE];
+    char *lowered = lowered_space;
+    int32_t *rows = 0;
+    
+    if (pattern.size > TLDUI_MAX_PATTERN_SIZE) {
+        int32_t rows_size = tld_fuzzy_rows_size(pattern.size);
+        char *memory = 0;
+        if (scratch) {
+            memory = (char *) tld_fuzzy_scratch_reserve(scratch, rows_size + pattern.size);
+        }
+        
+        if (memory) {
+            rows = (int32_t *) memory;
+            lowered = memory + rows_size;
+        } else {
+            pattern.size = TLDUI_MAX_PATTERN_SIZE;
+        }
+    }
+    
+    tld_fuzzy_pattern prepared = tld_fuzzy_make_pattern(pattern, lowered);
+    prepared.rows = rows;
+    tld_fuzzy_raw_text text = {val, val.size};
+    return tld_fuzzy_match_text(&prepared, &text, 0);
+}
+
+// Takes the lowered pattern, its table rows, the trace and the positions for a
+// value of the given size from the scratch.
+static bool32
+tld_fuzzy_prepare_trace(tld_fuzzy_scratch *scratch, String pattern, int32_t val_size,
+                        tld_fuzzy_pattern *prepared, uint64_t **trace, uint64_t **positions)
+{
+    int32_t trace_size = sizeof(uint64_t) * tld_fuzzy_trace_size(pattern.size, val_size);
+    int32_t positions_size = sizeof(uint64_t) * ((val_size + 63) / 64);
+    int32_t rows_size = tld_fuzzy_rows_size(pattern.size);
+    
+    char *memory = (char *) tld_fuzzy_scratch_reserve(
+        scratch, trace_size + positions_size + rows_size + pattern.size);
+    if (memory == 0) return false;
+    
+    *trace = (uint64_t *) memory;
+    *positions = (uint64_t *)(memory + trace_size);
+    
+    memory += trace_size + positions_size;
+    *prepared = tld_fuzzy_make_pattern(pattern, memory + rows_size);
+    if (rows_size > 0) {
+        prepared->rows = (int32_t *) memory;
+    }
+    
+    return true;
+}
+
+// Scores like tld_fuzzy_match_ss, and sets bit j of positions, which must have
+// room for (val.size + 63) / 64 words, for every character j of val that is
+// part of the best match. If the scratch cannot hold the trace, the score is
+// still returned, but no positions are set.
+static int32_t
+tld_fuzzy_match_positions(String pattern, String val, uint64_t *positions,
+                          tld_fuzzy_scratch *scratch)
+{
+    tld_fuzzy_pattern prepared;
+    uint64_t *trace;
+    uint64_t *unused;
+    
+    if (!tld_fuzzy_prepare_trace(scratch, pattern, val.size, &prepared, &trace, &unused)) {
+        memset(positions, 0, sizeof(uint64_t) * ((val.size + 63) / 64));
+        return tld_fuzzy_match_ss(pattern, val, scratch);
+    }
+    
+    tld_fuzzy_raw_text text = {val, val.size};
+    return tld_fuzzy_match_positions_text(&prepared, &text, trace, positions);
+}
+
+// A list of candidate strings for tldui_query_fuzzy_list. The strings are
+// stored back to back in one block of text, along with everything the matcher
+// would otherwise recompute for every table cell: a lowered copy of the text,
+// bitmaps of separators and word starts, and each string's character mask.
+// Build it once per list with tldui_fuzzy_corpus_push. Strings can be removed
+// from a corpus that is kept up to date, see tldui_fuzzy_corpus_remove.
+// Every change gives the corpus a new generation, unique among all corpora, so
+// that results ranked for one can be recognized as stale, see tldui_fuzzy_memo.
+struct tldui_fuzzy_corpus {
+    int32_t count;
+    int32_t capacity;
+    uint64_t generation;
+    uint32_t *offsets; // count + 1 offsets into the text
+    uint64_t *char_masks;
+    
+    int32_t removed_count;
+    uint8_t *removed; // Bitmap, allocated by the first removal
+    int32_t *biases; // Allocated by the first tldui_fuzzy_corpus_set_bias
+    
+    uint32_t text_size;
+    uint32_t text_capacity;
+    char *text;
+    char *lowered;
+    uint8_t *separators;
+    uint8_t *word_starts;
+};
+
+static inline String
+tldui_fuzzy_corpus_get(tldui_fuzzy_corpus *corpus, int32_t index) {
+    uint32_t offset = corpus->offsets[index];
+    return make_string(corpus->text + offset, corpus->offsets[index + 1] - offset);
+}
+
+static inline int32_t
+tldui_fuzzy_corpus_size(tldui_fuzzy_corpus *corpus, int32_t index) {
+    return (int32_t)(corpus->offsets[index + 1] - corpus->offsets[index]);
+}
+
+static inline tld_fuzzy_corpus_text
+tldui_fuzzy_corpus_text(tldui_fuzzy_corpus *corpus, int32_t index) {
+    tld_fuzzy_corpus_text result;
+    result.base = corpus->offsets[index];
+    result.size = (int32_t)(corpus->offsets[index + 1] - result.base);
+    result.lowered = corpus->lowered + result.base;
+    result.separators = corpus->separators;
+    result.word_starts = corpus->word_starts;
+    return result;
+}
+
+static uint64_t tldui_fuzzy_corpus_generations = 0;
+
+// Corpora may be built on other threads, such as the file index's. Threads
+// are only used where GCC's builtins are available.
+static inline uint64_t
+tldui_fuzzy_corpus_next_generation() {
+#ifdef __GNUC__
+    return __sync_add_and_fetch(&tldui_fuzzy_corpus_generations, 1);
+#else
+    return ++tldui_fuzzy_corpus_generations;
+#endif
+}
+
+static bool32
+tldui_fuzzy_corpus_push(tldui_fuzzy_corpus *corpus, String value) {
+    if (corpus->count + 1 >= corpus->capacity) {
+        int32_t capacity = max(2 * corpus->capacity, 64);
+        
+        uint32_t *offsets = (uint32_t *) realloc(corpus->offsets, sizeof(uint32_t) * capacity);
+        if (offsets == 0) return false;
+        corpus->offsets = offsets;
+        
+        uint64_t *char_masks = (uint64_t *) realloc(corpus->char_masks, sizeof(uint64_t) * capacity);
+        if (char_masks == 0) return false;
+        corpus->char_masks = char_masks;
+        
+        if (corpus->biases) {
+            int32_t *biases = (int32_t *) realloc(corpus->biases, sizeof(int32_t) * capacity);
+            if (biases == 0) return false;
+            memset(biases + corpus->capacity, 0, sizeof(int32_t) * (capacity - corpus->capacity));
+            corpus->biases = biases;
+        }
+        
+        if (corpus->removed) {
+            uint8_t *removed = (uint8_t *) realloc(corpus->removed, (capacity + 7) / 8);
+            if (removed == 0) return false;
+            memset(removed + (corpus->capacity + 7) / 8, 0, (capacity + 7) / 8 - (corpus->capacity + 7) / 8);
+            corpus->removed = removed;
+        }
+        
+        corpus->capacity = capacity;
+    }
+    
+    if (corpus->text_capacity - corpus->text_size < (uint32_t) value.size) {
+        uint32_t capacity = max(2 * corpus->text_capacity, corpus->text_size + value.size);
+        capacity = max(capacity, 4096);
+        uint32_t bitmap_size = (capacity + 7) / 8;
+        uint32_t old_bitmap_size = (corpus->text_capacity + 7) / 8;
+        
+        char *text = (char *) realloc(corpus->text, capacity);
+        if (text == 0) return false;
+        corpus->text = text;
+        
+        char *lowered = (char *) realloc(corpus->lowered, capacity);
+        if (lowered == 0) return false;
+        corpus->lowered = lowered;
+        
+        uint8_t *separators = (uint8_t *) realloc(corpus->separators, bitmap_size);
+        if (separators == 0) return false;
+        memset(separators + old_bitmap_size, 0, bitmap_size - old_bitmap_size);
+        corpus->separators = separators;
+        
+        uint8_t *word_starts = (uint8_t *) realloc(corpus->word_starts, bitmap_size);
+        if (word_starts == 0) return false;
+        memset(word_starts + old_bitmap_size, 0, bitmap_size - old_bitmap_size);
+        corpus->word_starts = word_starts;
+        
+        corpus->text_capacity = capacity;
+    }
+    
+    uint32_t base = corpus->text_size;
+    if (corpus->count == 0) {
+        corpus->offsets[0] = 0;
+    }
+    
+    for (int32_t j = 0; j < value.size; ++j) {
+        uint32_t bit = base + j;
+        corpus->text[bit] = value.str[j];
+        corpus->lowered[bit] = tld_fuzzy_lower(value, j);
+        
+        if (tld_char_is_separator(value.str[j])) {
+            corpus->separators[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+        }
+        
+        if (tld_fuzzy_is_word_start(value, j)) {
+            corpus->word_starts[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+        }
+    }
+    
+    corpus->char_masks[corpus->count] = tld_fuzzy_char_mask(value);
+    corpus->text_size += value.size;
+    corpus->count += 1;
+    corpus->offsets[corpus->count] = corpus->text_size;
+    corpus->generation = tldui_fuzzy_corpus_next_generation();
+    
+    return true;
+}
+
+static inline bool32
+tldui_fuzzy_corpus_is_removed(tldui_fuzzy_corpus *corpus, int32_t index) {
+    return corpus->removed && ((corpus->removed[index >> 3] >> (index & 7)) & 1);
+}
+
+// Takes a string out of the results of future queries. It keeps its index, so
+// that indices into the corpus held elsewhere stay valid, and its text, until
+// the owner rebuilds the corpus from the strings that are left.
+// A removed string has no characters as far as the mask test is concerned, so
+// no pattern but the empty one gets past it.
+static bool32
+tldui_fuzzy_corpus_remove(tldui_fuzzy_corpus *corpus, int32_t index) {
+    Assert(index >= 0 && index < corpus->count);
+    if (tldui_fuzzy_corpus_is_removed(corpus, index)) return true;
+    
+    if (corpus->removed == 0) {
+        corpus->removed = (uint8_t *) calloc((corpus->capacity + 7) / 8, 1);
+        if (corpus->removed == 0) return false;
+    }
+    
+    corpus->removed[index >> 3] |= (uint8_t)(1 << (index & 7));
+    corpus->char_masks[index] = 0;
+    corpus->removed_count += 1;
+    corpus->generation = tldui_fuzzy_corpus_next_generation();
+    
+    return true;
+}
+
+// Adds bias to the score of the string whenever it matches, so that it ranks
+// before strings that match equally well, e.g. because it was picked more
+// often. Keep biases small, or better matches will be buried.
+static bool32
+tldui_fuzzy_corpus_set_bias(tldui_fuzzy_corpus *corpus, int32_t index, int32_t bias) {
+    Assert(index >= 0 && index < corpus->count);
+    
+    if (corpus->biases == 0) {
+        if (bias == 0) return true;
+        
+        corpus->biases = (int32_t *) calloc(corpus->capacity, sizeof(int32_t));
+        if (corpus->biases == 0) return false;
+    }
+    
+    if (corpus->biases[index] != bias) {
+        corpus->biases[index] = bias;
+        corpus->generation = tldui_fuzzy_corpus_next_generation();
+    }
+    
+    return true;
+}
+
+// The score a match is ranked by
+static inline int32_t
+tldui_fuzzy_corpus_rank(tldui_fuzzy_corpus *corpus, int32_t index, int32_t score) {
+    return corpus->biases ? score + corpus->biases[index] : score;
+}
+
+static inline void
+tldui_fuzzy_corpus_free(tldui_fuzzy_corpus *corpus) {
+    free(corpus->offsets);
+    free(corpus->char_masks);
+    free(corpus->removed);
+    free(corpus->biases);
+    free(corpus->text);
+    free(corpus->lowered);
+    free(corpus->separators);
+    free(corpus->word_starts);
+    *corpus = {0};
+}
+
+// 
+// Worker Pool
+// 
+
+#ifndef TLDUI_MAX_WORKER_COUNT
+#ifdef _WIN32
+#define TLDUI_MAX_WORKER_COUNT 1
+#else
+#define TLDUI_MAX_WORKER_COUNT 8
+#endif
+#endif
+
+#ifndef TLDUI_PARALLEL_THRESHOLD
+#define TLDUI_PARALLEL_THRESHOLD 4096
+#endif
+
+typedef void (*tldui_parallel_proc)(void *data, int32_t index);
+
+#if TLDUI_MAX_WORKER_COUNT > 1
+#include <pthread.h>
+#include <unistd.h>
+
+// A lazily started set of threads that execute tldui_parallel_for batches.
+// The calling thread participates in every batch, so thread_count counts the
+// helper threads only. Batches may be started from any thread; the pool runs
+// one at a time, and callers wait on batch_mutex for their turn.
+struct tldui_worker_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+    pthread_mutex_t batch_mutex;
+    pthread_once_t started;
+    
+    tldui_parallel_proc proc;
+    void *data;
+    int32_t job_count;
+    int32_t next_job;
+    int32_t jobs_done;
+    
+    int32_t thread_count;
+};
+
+static tldui_worker_pool tldui_workers = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT
+};
+
+// Runs jobs of the current batch until none are left. Expects the pool mutex
+// to be held, and returns with it held.
+static void
+tldui_worker_pool_drain(tldui_worker_pool *pool) {
+    while (pool->next_job < pool->job_count) {
+        int32_t job = pool->next_job++;
+        tldui_parallel_proc proc = pool->proc;
+        void *data = pool->data;
+        
+        pthread_mutex_unlock(&pool->mutex);
+        proc(data, job);
+        pthread_mutex_lock(&pool->mutex);
+        
+        pool->jobs_done += 1;
+        if (pool->jobs_done == pool->job_count) {
+            pthread_cond_broadcast(&pool->work_done);
+        }
+    }
+}
+
+static void *
+tldui_worker_thread_main(void *param) {
+    tldui_worker_pool *pool = (tldui_worker_pool *) param;
+    
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (pool->next_job >= pool->job_count) {
+            pthread_cond_wait(&pool->work_available, &pool->mutex);
+        }
+        tldui_worker_pool_drain(pool);
+    }
+    
+    return 0;
+}
+
+static void
+tldui_worker_pool_start() {
+    tldui_worker_pool *pool = &tldui_workers;
+    
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int32_t wanted = (int32_t) min(cores, TLDUI_MAX_WORKER_COUNT) - 1;
+    
+    for (int32_t i = 0; i < wanted; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, tldui_worker_thread_main, pool) != 0) break;
+        
+        pthread_detach(thread);
+        pool->thread_count += 1;
+    }
+}
+
+static int32_t
+tldui_worker_count() {
+    tldui_worker_pool *pool = &tldui_workers;
+    pthread_once(&pool->started, tldui_worker_pool_start);
+    return pool->thread_count + 1;
+}
+
+// Calls proc(data, i) for every i in [0, count), spread across the worker
+// pool, and returns once all calls have finished. If another thread's batch
+// is running, this waits for it to finish first, so proc must not start a
+// batch of its own.
+static void
+tldui_parallel_for(tldui_parallel_proc proc, void *data, int32_t count) {
+    tldui_worker_pool *pool = &tldui_workers;
+    if (count <= 1 || tldui_worker_count() <= 1) {
+        for (int32_t i = 0; i < count; ++i) {
+            proc(data, i);
+        }
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->batch_mutex);
+    pthread_mutex_lock(&pool->mutex);
+    pool->proc = proc;
+    pool->data = data;
+    pool->job_count = count;
+    pool->next_job = 0;
+    pool->jobs_done = 0;
+    pthread_cond_broadcast(&pool->work_available);
+    
+    tldui_worker_pool_drain(pool);
+    while (pool->jobs_done < pool->job_count) {
+        pthread_cond_wait(&pool->work_done, &pool->mutex);
+    }
+    
+    pool->job_count = 0;
+    pool->next_job = 0;
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->batch_mutex);
+}
+#else
+static inline int32_t
+tldui_worker_count() {
+    return 1;
+}
+
+static void
+tldui_parallel_for(tldui_parallel_proc proc, void *data, int32_t count) {
+    for (int32_t i = 0; i < count; ++i) {
+        proc(data, i);
+    }
+}
+#endif
+
+// 
+// Incremental Ranking
+// 
+
+// The best matches of a scoring pass. Higher scores rank first; ties are
+// broken by list order, so that the ranking is a total order and partial
+// results can be merged in any order without changing the outcome.
+// The entries form a binary heap with the worst match at the root, until
+// tldui_top_k_sort puts them in ranking order. The caller provides the memory.
+struct tldui_top_k {
+    int32_t count;
+    int32_t capacity;
+    int32_t *indices;
+    int32_t *scores;
+};
+
+static inline tldui_top_k
+tldui_make_top_k(int32_t *indices, int32_t *scores, int32_t capacity) {
+    tldui_top_k result;
+    result.count = 0;
+    result.capacity = capacity;
+    result.indices = indices;
+    result.scores = scores;
+    return result;
+}
+
+static inline bool32
+tldui_ranks_before(int32_t score_a, int32_t index_a, int32_t score_b, int32_t index_b) {
+    return (score_a > score_b) || (score_a == score_b && index_a < index_b);
+}
+
+static inline bool32
+tldui_top_k_ranks_before(tldui_top_k *top, int32_t a, int32_t b) {
+    return tldui_ranks_before(top->scores[a], top->indices[a], top->scores[b], top->indices[b]);
+}
+
+static inline void
+tldui_top_k_swap(tldui_top_k *top, int32_t a, int32_t b) {
+    int32_t s = top->indices[a];
+    top->indices[a] = top->indices[b];
+    top->indices[b] = s;
+    
+    int32_t c = top->scores[a];
+    top->scores[a] = top->scores[b];
+    top->scores[b] = c;
+}
+
+static void
+tldui_top_k_sift_down(tldui_top_k *top, int32_t i, int32_t count) {
+    while (true) {
+        int32_t worst = i;
+        int32_t left = 2 * i + 1;
+        int32_t right = left + 1;
+        
+        if (left < count && tldui_top_k_ranks_before(top, worst, left)) {
+            worst = left;
+        }
+        if (right < count && tldui_top_k_ranks_before(top, worst, right)) {
+            worst = right;
+        }
+        
+        if (worst == i) break;
+        
+        tldui_top_k_swap(top, i, worst);
+        i = worst;
+    }
+}
+
+static inline void
+tldui_top_k_insert(tldui_top_k *top, int32_t index, int32_t score) {
+    if (top->count < top->capacity) {
+        int32_t i = top->count++;
+        top->indices[i] = index;
+        top->scores[i] = score;
+        
+        while (i > 0) {
+            int32_t parent = (i - 1) / 2;
+            if (!tldui_top_k_ranks_before(top, parent, i)) break;
+            
+            tldui_top_k_swap(top, i, parent);
+            i = parent;
+        }
+    } else if (top->count > 0 &&
+               tldui_ranks_before(score, index, top->scores[0], top->indices[0]))
+    {
+        top->indices[0] = index;
+        top->scores[0] = score;
+        tldui_top_k_sift_down(top, 0, top->count);
+    }
+}
+
+static inline void
+tldui_top_k_merge(tldui_top_k *dest, tldui_top_k *src) {
+    for (int32_t i = 0; i < src->count; ++i) {
+        tldui_top_k_insert(dest, src->indices[i], src->scores[i]);
+    }
+}
+
+// Orders the entries best first. Afterwards, they no longer form a heap, so
+// nothing may be inserted until count is reset.
+static void
+tldui_top_k_sort(tldui_top_k *top) {
+    for (int32_t end = top->count - 1; end > 0; --end) {
+        tldui_top_k_swap(top, 0, end);
+        tldui_top_k_sift_down(top, 0, end);
+    }
+}
+
+#ifndef TLDUI_RESUME_MEMORY
+#define TLDUI_RESUME_MEMORY (64 << 20)
+#endif
+
+// Backing memory for the saved matcher states of a survivor level
+struct tldui_state_chunk {
+    tldui_state_chunk *next;
+    int32_t used;
+    int32_t capacity;
+};
+
+static int32_t *
+tldui_state_alloc(tldui_state_chunk **chunks, int32_t size) {
+    tldui_state_chunk *chunk = *chunks;
+    
+    if (chunk == 0 || chunk->capacity - chunk->used < size) {
+        int32_t capacity = max(size, (256 << 10) / (int32_t) sizeof(int32_t));
+        chunk = (tldui_state_chunk *) malloc(sizeof(tldui_state_chunk) + sizeof(int32_t) * capacity);
+        if (chunk == 0) return 0;
+        
+        chunk->next = *chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        *chunks = chunk;
+    }
+    
+    int32_t *result = (int32_t *)(chunk + 1) + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+// Returns the most recent allocation of the given size
+static inline void
+tldui_state_pop(tldui_state_chunk *chunks, int32_t size) {
+    Assert(chunks && chunks->used >= size);
+    chunks->used -= size;
+}
+
+static inline void
+tldui_state_free(tldui_state_chunk *chunks) {
+    while (chunks) {
+        tldui_state_chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+}
+
+// The candidates that matched the pattern prefix of a given length, in list
+// order, along with their scores and, where memory permitted, their matcher
+// states for tld_fuzzy_resume_text.
+struct tldui_survivor_level {
+    int32_t pattern_length;
+    int32_t count;
+    int32_t *indices;
+    int32_t *scores;
+    int32_t **states;
+    
+    void *memory;
+    tldui_state_chunk *state_chunks;
+};
+
+// Since a string can only match a pattern if it matches every prefix of that
+// pattern, each keystroke only needs to look at the survivors of the previous
+// one. Keeping one level per pattern length also lets backspace return to an
+// earlier level without scoring anything, and typing a character only has to
+// compute one more row of each survivor's table from its saved state.
+// The whole list is the implicit bottom level, matching the empty pattern
+// with a score of 1, same as tld_fuzzy_match_ss. Patterns longer than the
+// topmost level are scored from its survivors without adding a level.
+// The scratch holds the tables of patterns longer than TLDUI_MAX_PATTERN_SIZE.
+struct tldui_survivor_stack {
+    tldui_survivor_level levels[TLDUI_MAX_PATTERN_SIZE];
+    int32_t level_count;
+    
+    // The pattern of the topmost level, every other level's is a prefix of it
+    char pattern[TLDUI_MAX_PATTERN_SIZE];
+    
+    tld_fuzzy_scratch scratch;
+};
+
+static inline void
+tldui_survivor_stack_pop(tldui_survivor_stack *stack) {
+    Assert(stack->level_count > 0);
+    stack->level_count -= 1;
+    free(stack->levels[stack->level_count].memory);
+    tldui_state_free(stack->levels[stack->level_count].state_chunks);
+    stack->levels[stack->level_count] = {0};
+}
+
+static inline void
+tldui_survivor_stack_free(tldui_survivor_stack *stack) {
+    while (stack->level_count > 0) {
+        tldui_survivor_stack_pop(stack);
+    }
+    
+    tld_fuzzy_scratch_free(&stack->scratch);
+}
+
+// One slice of a scoring pass over a survivor level (or the whole list, if
+// parent_indices is 0). If pattern is as long as the parent level's pattern,
+// the stored scores are reused, otherwise the candidates are rescored and the
+// survivors written to out_indices/out_scores/out_states, starting at index
+// first. If resume is set, the pattern is one character longer than the
+// parent's, and candidates with a saved state only need one more table row.
+struct tldui_fuzzy_job {
+    tldui_fuzzy_corpus *corpus;
+    int32_t *parent_indices;
+    int32_t *parent_scores;
+    int32_t **parent_states;
+    int32_t first;
+    int32_t one_past_last;
+    
+    tld_fuzzy_pattern pattern;
+    bool32 rescore;
+    bool32 resume;
+    
+    int32_t *out_indices;
+    int32_t *out_scores;
+    int32_t **out_states;
+    int32_t out_count;
+    
+    tldui_state_chunk *state_chunks;
+    int64_t state_budget;
+    
+    // Matcher states of a block of batched candidates, see tldui_fuzzy_score_block
+    tld_fuzzy_scratch batch_scratch;
+    
+    tldui_top_k top;
+};
+
+static inline void
+tldui_fuzzy_job_output(tldui_fuzzy_job *job, int32_t index, int32_t score, int32_t *state) {
+    if (job->out_indices) {
+        job->out_indices[job->first + job->out_count] = index;
+        job->out_scores[job->first + job->out_count] = score;
+        if (job->out_states) {
+            job->out_states[job->first + job->out_count] = state;
+        }
+        job->out_count += 1;
+    }
+    
+    tldui_top_k_insert(&job->top, index, tldui_fuzzy_corpus_rank(job->corpus, index, score));
+}
+
+// Scores entry k of the parent level, which passed the mask test
+static void
+tldui_fuzzy_score_entry(tldui_fuzzy_job *job, int32_t k, int32_t index) {
+    tld_fuzzy_corpus_text candidate = tldui_fuzzy_corpus_text(job->corpus, index);
+    
+    int32_t state_size = tld_fuzzy_state_size(candidate.size);
+    int32_t *state = 0;
+    if (job->out_states && job->state_budget >= state_size * (int64_t) sizeof(int32_t)) {
+        state = tldui_state_alloc(&job->state_chunks, state_size);
+    }
+    
+    int32_t *parent_state = job->resume ? job->parent_states[k] : 0;
+    
+    int32_t score = 0;
+    if (parent_state && state) {
+        memcpy(state, parent_state, sizeof(int32_t) * state_size);
+        score = tld_fuzzy_resume_text(&job->pattern, &candidate, state);
+    } else {
+        score = tld_fuzzy_match_text(&job->pattern, &candidate, state);
+    }
+    
+    if (state) {
+        if (score > 0) {
+            job->state_budget -= state_size * sizeof(int32_t);
+        } else {
+            tldui_state_pop(job->state_chunks, state_size);
+            state = 0;
+        }
+    }
+    
+    if (score > 0) {
+        tldui_fuzzy_job_output(job, index, score, state);
+    }
+}
+
+#if TLD_FUZZY_BATCH_LANES
+#define TLDUI_BATCH_BLOCK_SIZE 256
+#define TLDUI_BATCH_BUCKET_COUNT 8
+
+// Scores a batch of entries of a block, see tldui_fuzzy_score_block
+static void
+tldui_fuzzy_score_batch(tldui_fuzzy_job *job, int32_t *entries, int32_t count, int32_t first,
+                        int32_t *scores, int32_t *states, int32_t *state_offsets)
+{
+    tld_fuzzy_corpus_text texts[TLD_FUZZY_BATCH_LANES];
+    int32_t *lane_states[TLD_FUZZY_BATCH_LANES];
+    int32_t lane_scores[TLD_FUZZY_BATCH_LANES];
+    
+    for (int32_t lane = 0; lane < count; ++lane) {
+        int32_t k = entries[lane];
+        int32_t i = job->parent_indices ? job->parent_indices[k] : k;
+        texts[lane] = tldui_fuzzy_corpus_text(job->corpus, i);
+        lane_states[lane] = states ? states + state_offsets[k - first] : 0;
+    }
+    
+    tld_fuzzy_match_batch(&job->pattern, texts, count, states ? lane_states : 0, lane_scores);
+    
+    for (int32_t lane = 0; lane < count; ++lane) {
+        scores[entries[lane] - first] = lane_scores[lane];
+    }
+}
+
+// Scores the candidates of the given entries that can't resume from a saved
+// state with tld_fuzzy_match_batch, grouping them by length so that lanes
+// don't idle while a long string finishes, then outputs the survivors in
+// list order, same as tldui_fuzzy_score_entry would.
+// Their states are computed into the job's batch scratch first, and only
+// copied into the state chunks if they match and fit into the budget.
+static void
+tldui_fuzzy_score_block(tldui_fuzzy_job *job, int32_t first, int32_t one_past_last) {
+    tldui_fuzzy_corpus *corpus = job->corpus;
+    tld_fuzzy_pattern *pattern = &job->pattern;
+    
+    // -1 marks entries that resume from a saved state, 0 those that can't match
+    int32_t scores[TLDUI_BATCH_BLOCK_SIZE];
+    int32_t state_offsets[TLDUI_BATCH_BLOCK_SIZE];
+    int64_t states_size = 0;
+    
+    for (int32_t k = first; k < one_past_last; ++k) {
+        int32_t i = job->parent_indices ? job->parent_indices[k] : k;
+        
+        if ((pattern->mask & ~corpus->char_masks[i]) != 0) {
+            scores[k - first] = 0;
+        } else if (job->resume && job->parent_states[k]) {
+            scores[k - first] = -1;
+        } else {
+            scores[k - first] = 1;
+            state_offsets[k - first] = (int32_t) states_size;
+            states_size += tld_fuzzy_state_size(tldui_fuzzy_corpus_size(corpus, i));
+        }
+    }
+    
+    int32_t *states = 0;
+    if (job->out_states && job->state_budget > 0) {
+        states = (int32_t *) tld_fuzzy_scratch_reserve(&job->batch_scratch,
+                                                       (int32_t)(sizeof(int32_t) * states_size));
+    }
+    
+    int32_t queued[TLDUI_BATCH_BUCKET_COUNT][TLD_FUZZY_BATCH_LANES];
+    int32_t queued_count[TLDUI_BATCH_BUCKET_COUNT] = {0};
+    
+    for (int32_t k = first; k < one_past_last; ++k) {
+        if (scores[k - first] <= 0) continue;
+        
+        int32_t i = job->parent_indices ? job->parent_indices[k] : k;
+        int32_t bucket = min(tldui_fuzzy_corpus_size(corpus, i) / 16, TLDUI_BATCH_BUCKET_COUNT - 1);
+        queued[bucket][queued_count[bucket]++] = k;
+        
+        if (queued_count[bucket] == TLD_FUZZY_BATCH_LANES) {
+            tldui_fuzzy_score_batch(job, queued[bucket], TLD_FUZZY_BATCH_LANES, first,
+                                    scores, states, state_offsets);
+            queued_count[bucket] = 0;
+        }
+    }
+    
+    for (int32_t bucket = 0; bucket < TLDUI_BATCH_BUCKET_COUNT; ++bucket) {
+        if (queued_count[bucket] > 0) {
+            tldui_fuzzy_score_batch(job, queued[bucket], queued_count[bucket], first,
+                                    scores, states, state_offsets);
+        }
+    }
+    
+    for (int32_t k = first; k < one_past_last; ++k) {
+        int32_t i = job->parent_indices ? job->parent_indices[k] : k;
+        int32_t score = scores[k - first];
+        
+        if (score < 0) {
+            tldui_fuzzy_score_entry(job, k, i);
+        } else if (score > 0) {
+            int32_t *state = 0;
+            
+            if (states) {
+                int32_t state_size = tld_fuzzy_state_size(tldui_fuzzy_corpus_size(corpus, i));
+                if (job->state_budget >= state_size * (int64_t) sizeof(int32_t)) {
+                    state = tldui_state_alloc(&job->state_chunks, state_size);
+                }
+                
+                if (state) {
+                    memcpy(state, states + state_offsets[k - first], sizeof(int32_t) * state_size);
+                    job->state_budget -= state_size * sizeof(int32_t);
+                }
+            }
+            
+            tldui_fuzzy_job_output(job, i, score, state);
+        }
+    }
+}
+#endif
+
+static void
+tldui_fuzzy_score_range(tldui_fuzzy_job *job) {
+    tldui_fuzzy_corpus *corpus = job->corpus;
+    tld_fuzzy_pattern *pattern = &job->pattern;
+    
+    job->out_count = 0;
+    
+#if TLD_FUZZY_BATCH_LANES
+    // The scalar matcher skips to the first match and prunes the table, which
+    // beats computing it in full for very short patterns
+    if (job->rescore && !pattern->transpositions &&
+        pattern->size >= 3 && pattern->size <= TLD_FUZZY_BATCH_MAX_PATTERN_SIZE)
+    {
+        for (int32_t k = job->first; k < job->one_past_last; k += TLDUI_BATCH_BLOCK_SIZE) {
+            tldui_fuzzy_score_block(job, k, min(k + TLDUI_BATCH_BLOCK_SIZE, job->one_past_last));
+        }
+        return;
+    }
+#endif
+    
+    for (int32_t k = job->first; k < job->one_past_last; ++k) {
+        int32_t i = job->parent_indices ? job->parent_indices[k] : k;
+        
+        if (!job->rescore) {
+            int32_t score = job->parent_scores ? job->parent_scores[k] : 1;
+            tldui_top_k_insert(&job->top, i, tldui_fuzzy_corpus_rank(corpus, i, score));
+            continue;
+        }
+        
+        if ((pattern->mask & ~corpus->char_masks[i]) != 0) {
+            continue;
+        }
+        
+        tldui_fuzzy_score_entry(job, k, i);
+    }
+}
+
+static void
+tldui_fuzzy_score_job(void *data, int32_t index) {
+    tldui_fuzzy_job *jobs = (tldui_fuzzy_job *) data;
+    tldui_fuzzy_score_range(&jobs[index]);
+}
+
+// A scoring pass that brings the survivor stack up to date with a pattern.
+// It can be run in chunks, in between which the best matches found so far are
+// available, and abandoned before it completes, which leaves the stack as
+// tldui_fuzzy_pass_begin left it. The pass points into its own memory, so it
+// must not be moved once it has begun.
+struct tldui_fuzzy_pass {
+    tldui_survivor_stack *stack;
+    tldui_survivor_level parent;
+    tldui_survivor_level level;
+    
+    // Every job but the first collects its own top results, which are merged
+    // into those of the first after every chunk.
+    tldui_fuzzy_job jobs[TLDUI_MAX_WORKER_COUNT];
+    int32_t job_count;
+    int32_t *job_results;
+    
+    int64_t state_budget;
+    char lowered_space[TLDUI_MAX_PATTERN_SIZE];
+    
+    int32_t next;
+    bool32 done;
+};
+
+// Starts a pass for the pattern that collects the best matches into top, up
+// to its capacity. Levels whose pattern is not a prefix of the new one are
+// popped right away, so passes are cheapest if the pattern changes only at
+// its end, by typing, backspacing or clearing it.
+// Only the survivors of the longest level whose pattern is a prefix of the
+// new one are scored; if that level's pattern is the new pattern, its stored
+// scores are ranked without scoring anything. Each level saves the matcher
+// states of its survivors, up to TLDUI_RESUME_MEMORY bytes, so that the next
+// level can resume from them.
+// Levels larger than TLDUI_PARALLEL_THRESHOLD are split into contiguous slices
+// that are scored on the worker pool; the ranking and the order of survivors
+// are the same as those of a single-threaded pass.
+static void
+tldui_fuzzy_pass_begin(tldui_fuzzy_pass *pass,
+                       tldui_survivor_stack *stack,
+                       tldui_fuzzy_corpus *corpus,
+                       String pattern,
+                       tldui_top_k top)
+{
+    memset(pass, 0, sizeof(*pass));
+    pass->stack = stack;
+    pass->job_count = 1;
+    pass->jobs[0].top = top;
+    pass->jobs[0].top.count = 0;
+    
+    int32_t list_count = corpus->count;
+    
+    int32_t shared_size = 0;
+    int32_t stored_size = min(pattern.size, ArrayCount(stack->pattern));
+    while (shared_size < stored_size && stack->pattern[shared_size] == pattern.str[shared_size]) {
+        shared_size += 1;
+    }
+    
+    while (stack->level_count > 0 &&
+           stack->levels[stack->level_count - 1].pattern_length > shared_size)
+    {
+        tldui_survivor_stack_pop(stack);
+    }
+    memcpy(stack->pattern, pattern.str, stored_size);
+    
+    tldui_survivor_level parent = {0};
+    parent.count = list_count;
+    if (stack->level_count > 0) {
+        parent = stack->levels[stack->level_count - 1];
+    }
+    pass->parent = parent;
+    
+    if (parent.pattern_length == pattern.size && parent.indices == 0) {
+        // Everything matches the empty pattern equally well, so only biases
+        // make it worth looking past the first few strings
+        tldui_top_k *top_k = &pass->jobs[0].top;
+        for (int32_t i = 0; i < list_count; ++i) {
+            if (corpus->biases == 0 && top_k->count == top_k->capacity) break;
+            
+            if (!tldui_fuzzy_corpus_is_removed(corpus, i)) {
+                tldui_top_k_insert(top_k, i, tldui_fuzzy_corpus_rank(corpus, i, 1));
+            }
+        }
+        pass->done = true;
+        return;
+    }
+    
+    bool32 rescore = (parent.pattern_length < pattern.size);
+    
+    bool32 resume = (parent.states && parent.pattern_length + 1 == pattern.size);
+    
+    int32_t job_count = 1;
+    if (parent.count >= TLDUI_PARALLEL_THRESHOLD) {
+        job_count = tldui_worker_count();
+    }
+    if (job_count > 1) {
+        pass->job_results = (int32_t *) malloc(sizeof(int32_t) * 2 * top.capacity * (job_count - 1));
+        if (pass->job_results == 0) {
+            job_count = 1;
+        }
+    }
+    
+    // Long patterns are lowered into the scratch, followed by the table rows
+    // of each job.
+    char *lowered = pass->lowered_space;
+    char *job_rows = 0;
+    int32_t job_rows_size = (tld_fuzzy_rows_size(pattern.size) + 7) & ~7;
+    
+    if (pattern.size > TLDUI_MAX_PATTERN_SIZE) {
+        int32_t lowered_size = (pattern.size + 7) & ~7;
+        char *memory = (char *) tld_fuzzy_scratch_reserve(
+            &stack->scratch, lowered_size + job_rows_size * job_count);
+        
+        if (memory == 0) {
+            free(pass->job_results);
+            pass->job_results = 0;
+            pass->done = true;
+            return;
+        }
+        
+        lowered = memory;
+        job_rows = memory + lowered_size;
+    }
+    
+    tldui_survivor_level level = {0};
+    if (rescore && stack->level_count < ArrayCount(stack->levels) &&
+        pattern.size <= ArrayCount(stack->pattern))
+    {
+        level.pattern_length = pattern.size;
+        level.memory = malloc((sizeof(int32_t *) + 2 * sizeof(int32_t)) * max(parent.count, 1));
+        
+        if (level.memory) {
+            level.states = (int32_t **) level.memory;
+            level.indices = (int32_t *)(level.states + parent.count);
+            level.scores = level.indices + parent.count;
+#ifdef TLDUI_TRANSPOSE_PATTERNS
+            // Saved states don't account for transpositions
+            level.states = 0;
+#endif
+        }
+    }
+    pass->level = level;
+    
+    tld_fuzzy_pattern prepared = tld_fuzzy_make_pattern(pattern, lowered);
+#ifdef TLDUI_TRANSPOSE_PATTERNS
+    prepared.transpositions = true;
+#endif
+    
+    for (int32_t i = 0; i < job_count; ++i) {
+        tldui_fuzzy_job *job = &pass->jobs[i];
+        job->corpus = corpus;
+        job->parent_indices = parent.indices;
+        job->parent_scores = parent.scores;
+        job->parent_states = parent.states;
+        job->pattern = prepared;
+        if (job_rows) {
+            job->pattern.rows = (int32_t *)(job_rows + job_rows_size * i);
+        }
+        job->rescore = rescore;
+        job->resume = resume;
+        job->out_indices = level.indices;
+        job->out_scores = level.scores;
+        job->out_states = level.states;
+        job->state_chunks = 0;
+        
+        if (i > 0) {
+            int32_t *memory = pass->job_results + 2 * top.capacity * (i - 1);
+            job->top = tldui_make_top_k(memory, memory + top.capacity, top.capacity);
+        }
+    }
+    
+    pass->job_count = job_count;
+    pass->state_budget = TLDUI_RESUME_MEMORY;
+}
+
+// Scores up to chunk_size more entries of the parent level, and returns
+// whether the pass is complete.
+static bool32
+tldui_fuzzy_pass_step(tldui_fuzzy_pass *pass, int32_t chunk_size) {
+    if (pass->done) {
+        return true;
+    }
+    
+    tldui_fuzzy_job *jobs = pass->jobs;
+    int32_t job_count = pass->job_count;
+    int32_t first = pass->next;
+    int32_t count = min(pass->parent.count - first, max(chunk_size, 1));
+    int64_t state_share = pass->state_budget / job_count;
+    
+    for (int32_t i = 0; i < job_count; ++i) {
+        jobs[i].first = first + (int32_t)(((int64_t) count * i) / job_count);
+        jobs[i].one_past_last = first + (int32_t)(((int64_t) count * (i + 1)) / job_count);
+        jobs[i].state_budget = state_share;
+    }
+    
+    tldui_parallel_for(tldui_fuzzy_score_job, jobs, job_count);
+    
+    tldui_survivor_level *level = &pass->level;
+    for (int32_t i = 0; i < job_count; ++i) {
+        pass->state_budget -= state_share - jobs[i].state_budget;
+        
+        if (i > 0) {
+            tldui_top_k_merge(&jobs[0].top, &jobs[i].top);
+            jobs[i].top.count = 0;
+        }
+        
+        if (level->indices) {
+            // Each slice wrote its survivors at the start of its own range
+            memmove(level->indices + level->count, level->indices + jobs[i].first,
+                    sizeof(int32_t) * jobs[i].out_count);
+            memmove(level->scores + level->count, level->scores + jobs[i].first,
+                    sizeof(int32_t) * jobs[i].out_count);
+            if (level->states) {
+                memmove(level->states + level->count, level->states + jobs[i].first,
+                        sizeof(int32_t *) * jobs[i].out_count);
+            }
+            level->count += jobs[i].out_count;
+        }
+    }
+    
+    pass->next += count;
+    pass->done = (pass->next >= pass->parent.count);
+    return pass->done;
+}
+
+// Copies the best matches found so far to result, in ranking order. result
+// needs at least the capacity of the top results the pass was begun with.
+static void
+tldui_fuzzy_pass_results(tldui_fuzzy_pass *pass, tldui_top_k *result) {
+    tldui_top_k *top = &pass->jobs[0].top;
+    Assert(result->capacity >= top->count);
+    
+    result->count = top->count;
+    memcpy(result->indices, top->indices, sizeof(int32_t) * top->count);
+    memcpy(result->scores, top->scores, sizeof(int32_t) * top->count);
+    tldui_top_k_sort(result);
+}
+
+// Pushes the survivors of a completed pass onto the stack, or discards those
+// of an abandoned one.
+static void
+tldui_fuzzy_pass_end(tldui_fuzzy_pass *pass) {
+    free(pass->job_results);
+    pass->job_results = 0;
+    
+    tldui_survivor_level level = pass->level;
+    for (int32_t i = 0; i < pass->job_count; ++i) {
+        tldui_state_chunk *chunk = pass->jobs[i].state_chunks;
+        while (chunk) {
+            tldui_state_chunk *next = chunk->next;
+            chunk->next = level.state_chunks;
+            level.state_chunks = chunk;
+            chunk = next;
+        }
+        pass->jobs[i].state_chunks = 0;
+        
+        tld_fuzzy_scratch_free(&pass->jobs[i].batch_scratch);
+    }
+    
+    if (level.indices && pass->done) {
+        tldui_survivor_stack *stack = pass->stack;
+        stack->levels[stack->level_count++] = level;
+    } else {
+        free(level.memory);
+        tldui_state_free(level.state_chunks);
+    }
+    
+    pass->level = {0};
+}
+
+// Runs a whole pass for the pattern, see tldui_fuzzy_pass_begin, and collects
+// the best matches into result, up to its capacity, in ranking order.
+static void
+tldui_fuzzy_refine(tldui_survivor_stack *stack,
+                   tldui_fuzzy_corpus *corpus,
+                   String pattern,
+                   tldui_top_k *result)
+{
+    tldui_fuzzy_pass pass;
+    tldui_fuzzy_pass_begin(&pass, stack, corpus, pattern, *result);
+    while (!tldui_fuzzy_pass_step(&pass, corpus->count)) {}
+    
+    *result = pass.jobs[0].top;
+    tldui_top_k_sort(result);
+    tldui_fuzzy_pass_end(&pass);
+}
+
+// Writes a string of the corpus to out, with each run of characters that are
+// part of the best match of the pattern in brackets. Out must have room for
+// 2 * size + 1 characters, where size is the size of the string.
+static String
+tldui_fuzzy_highlight(tldui_fuzzy_corpus *corpus, int32_t index, String pattern,
+                      tld_fuzzy_scratch *scratch, char *out)
+{
+    String value = tldui_fuzzy_corpus_get(corpus, index);
+    String result = make_string_cap(out, 0, 2 * value.size + 1);
+    
+    tld_fuzzy_pattern prepared;
+    uint64_t *trace;
+    uint64_t *positions;
+    if (!tld_fuzzy_prepare_trace(scratch, pattern, value.size, &prepared, &trace, &positions)) {
+        append_ss(&result, value);
+        return result;
+    }
+#ifdef TLDUI_TRANSPOSE_PATTERNS
+    prepared.transpositions = true;
+#endif
+    
+    tld_fuzzy_corpus_text text = tldui_fuzzy_corpus_text(corpus, index);
+    tld_fuzzy_match_positions_text(&prepared, &text, trace, positions);
+    
+    bool32 in_run = false;
+    for (int32_t j = 0; j < value.size; ++j) {
+        bool32 matched = (positions[j / 64] >> (j % 64)) & 1;
+        if (matched != in_run) {
+            append_s_char(&result, matched ? '[' : ']');
+            in_run = matched;
+        }
+        append_s_char(&result, value.str[j]);
+    }
+    if (in_run) {
+        append_s_char(&result, ']');
+    }
+    
+    return result;
+}
+
+// 
+// Background Searches
+// 
+
+#ifndef TLDUI_FUZZY_CHUNK_SIZE
+#define TLDUI_FUZZY_CHUNK_SIZE 32768
+#endif
+
+#if TLDUI_MAX_WORKER_COUNT > 1
+#include <time.h>
+#endif
+
+// Runs the scoring passes of a fuzzy list query on a thread of its own, so
+// that the UI thread can go back to waiting for input right away. A new
+// request cancels the pass for the previous one after at most
+// TLDUI_FUZZY_CHUNK_SIZE more candidates, and the best matches found so far
+// are published after every chunk.
+// Without threading, or if the thread can't be started, every request is
+// scored to completion before tldui_fuzzy_search_request returns.
+struct tldui_fuzzy_search {
+    tldui_fuzzy_corpus *corpus;
+    
+    // Guarded by the mutex while the thread is running
+    String pattern;
+    int32_t generation;
+    bool32 requested;
+    tldui_top_k published;
+    int32_t published_generation;
+    int32_t published_version;
+    bool32 published_done;
+    bool32 quit;
+    
+    // Only touched by the scoring thread
+    tldui_survivor_stack survivors;
+    String working_pattern;
+    tldui_top_k top;
+    
+    void *memory;
+    bool32 thread_running;
+#if TLDUI_MAX_WORKER_COUNT > 1
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+#endif
+};
+
+static inline void
+tldui_fuzzy_search_lock(tldui_fuzzy_search *search) {
+#if TLDUI_MAX_WORKER_COUNT > 1
+    if (search->thread_running) {
+        pthread_mutex_lock(&search->mutex);
+    }
+#endif
+}
+
+static inline void
+tldui_fuzzy_search_unlock(tldui_fuzzy_search *search) {
+#if TLDUI_MAX_WORKER_COUNT > 1
+    if (search->thread_running) {
+        pthread_mutex_unlock(&search->mutex);
+    }
+#endif
+}
+
+// Expects the lock to be held
+static void
+tldui_fuzzy_search_publish(tldui_fuzzy_search *search, tldui_fuzzy_pass *pass,
+                           int32_t generation, bool32 done)
+{
+    tldui_fuzzy_pass_results(pass, &search->published);
+    search->published_generation = generation;
+    search->published_version += 1;
+    search->published_done = done;
+}
+
+#if TLDUI_MAX_WORKER_COUNT > 1
+static void *
+tldui_fuzzy_search_thread_main(void *param) {
+    tldui_fuzzy_search *search = (tldui_fuzzy_search *) param;
+    int32_t scored_generation = 0;
+    
+    pthread_mutex_lock(&search->mutex);
+    while (true) {
+        while (!search->quit && search->generation == scored_generation) {
+            pthread_cond_wait(&search->changed, &search->mutex);
+        }
+        if (search->quit) break;
+        
+        if (!search->requested) {
+            scored_generation = search->generation;
+            continue;
+        }
+        
+        int32_t generation = search->generation;
+        copy_partial_ss(&search->working_pattern, search->pattern);
+        pthread_mutex_unlock(&search->mutex);
+        
+        tldui_fuzzy_pass pass;
+        tldui_fuzzy_pass_begin(&pass, &search->survivors, search->corpus,
+                               search->working_pattern, search->top);
+        
+        bool32 done = false;
+        bool32 stale = false;
+        while (!done && !stale) {
+            done = tldui_fuzzy_pass_step(&pass, TLDUI_FUZZY_CHUNK_SIZE);
+            
+            pthread_mutex_lock(&search->mutex);
+            stale = (search->quit || search->generation != generation);
+            if (!stale) {
+                tldui_fuzzy_search_publish(search, &pass, generation, done);
+                pthread_cond_broadcast(&search->changed);
+            }
+            pthread_mutex_unlock(&search->mutex);
+        }
+        
+        tldui_fuzzy_pass_end(&pass);
+        scored_generation = generation;
+        
+        pthread_mutex_lock(&search->mutex);
+    }
+    pthread_mutex_unlock(&search->mutex);
+    
+    return 0;
+}
+#endif
+
+// Prepares a search of the corpus for patterns of up to pattern_capacity
+// bytes, which publishes up to result_capacity matches.
+// Returns false if out of memory.
+static bool32
+tldui_fuzzy_search_start(tldui_fuzzy_search *search,
+                         tldui_fuzzy_corpus *corpus,
+                         int32_t result_capacity,
+                         int32_t pattern_capacity)
+{
+    memset(search, 0, sizeof(*search));
+    search->corpus = corpus;
+    
+    search->memory = malloc(sizeof(int32_t) * 4 * result_capacity + 2 * pattern_capacity);
+    if (search->memory == 0) {
+        return false;
+    }
+    
+    int32_t *results = (int32_t *) search->memory;
+    search->top = tldui_make_top_k(results, results + result_capacity, result_capacity);
+    results += 2 * result_capacity;
+    search->published = tldui_make_top_k(results, results + result_capacity, result_capacity);
+    results += 2 * result_capacity;
+    
+    char *patterns = (char *) results;
+    search->pattern = make_string_cap(patterns, 0, pattern_capacity);
+    search->working_pattern = make_string_cap(patterns + pattern_capacity, 0, pattern_capacity);
+    
+#if TLDUI_MAX_WORKER_COUNT > 1
+    pthread_mutex_init(&search->mutex, 0);
+    pthread_cond_init(&search->changed, 0);
+    
+    if (pthread_create(&search->thread, 0, tldui_fuzzy_search_thread_main, search) == 0) {
+        search->thread_running = true;
+    } else {
+        pthread_cond_destroy(&search->changed);
+        pthread_mutex_destroy(&search->mutex);
+    }
+#endif
+    
+    return true;
+}
+
+// Stops scoring and frees everything the search holds on to
+static void
+tldui_fuzzy_search_stop(tldui_fuzzy_search *search) {
+#if TLDUI_MAX_WORKER_COUNT > 1
+    if (search->thread_running) {
+        pthread_mutex_lock(&search->mutex);
+        search->quit = true;
+        pthread_cond_broadcast(&search->changed);
+        pthread_mutex_unlock(&search->mutex);
+        
+        pthread_join(search->thread, 0);
+        pthread_cond_destroy(&search->changed);
+        pthread_mutex_destroy(&search->mutex);
+        search->thread_running = false;
+    }
+#endif
+    
+    tldui_survivor_stack_free(&search->survivors);
+    free(search->memory);
+    search->memory = 0;
+}
+
+// Asks for the pattern to be scored, abandoning the pass for any earlier
+// request. Requests that are replaced before the thread gets to them are
+// skipped.
+static void
+tldui_fuzzy_search_request(tldui_fuzzy_search *search, String pattern) {
+    tldui_fuzzy_search_lock(search);
+    copy_partial_ss(&search->pattern, pattern);
+    search->generation += 1;
+    search->requested = true;
+    
+#if TLDUI_MAX_WORKER_COUNT > 1
+    if (search->thread_running) {
+        pthread_cond_broadcast(&search->changed);
+        pthread_mutex_unlock(&search->mutex);
+        return;
+    }
+#endif
+    
+    tldui_fuzzy_pass pass;
+    tldui_fuzzy_pass_begin(&pass, &search->survivors, search->corpus,
+                           search->pattern, search->top);
+    while (!tldui_fuzzy_pass_step(&pass, search->corpus->count)) {}
+    
+    tldui_fuzzy_search_publish(search, &pass, search->generation, true);
+    tldui_fuzzy_pass_end(&pass);
+}
+
+// Abandons the pass for the latest request, if it's still running, and
+// discards its results.
+static void
+tldui_fuzzy_search_cancel(tldui_fuzzy_search *search) {
+    tldui_fuzzy_search_lock(search);
+    search->generation += 1;
+    search->requested = false;
+    
+#if TLDUI_MAX_WORKER_COUNT > 1
+    if (search->thread_running) {
+        pthread_cond_broadcast(&search->changed);
+    }
+#endif
+    
+    tldui_fuzzy_search_unlock(search);
+}
+
+// Waits up to the given number of milliseconds, or as long as it takes if
+// that's negative, for the latest request to be scored completely, and
+// returns whether it was.
+static bool32
+tldui_fuzzy_search_wait(tldui_fuzzy_search *search, int32_t milliseconds) {
+    bool32 result = true;
+    
+#if TLDUI_MAX_WORKER_COUNT > 1
+    if (search->thread_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += milliseconds / 1000;
+        deadline.tv_nsec += (milliseconds % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        
+        pthread_mutex_lock(&search->mutex);
+        while (search->published_generation != search->generation || !search->published_done) {
+            if (milliseconds < 0) {
+                pthread_cond_wait(&search->changed, &search->mutex);
+            } else if (pthread_cond_timedwait(&search->changed, &search->mutex, &deadline) != 0) {
+                break;
+            }
+        }
+        result = (search->published_generation == search->generation && search->published_done);
+        pthread_mutex_unlock(&search->mutex);
+    }
+#endif
+    
+    return result;
+}
+
+// Copies the matches published for the latest request to result, in ranking
+// order, if they changed since *version was last updated by this function.
+// result needs at least the result capacity the search was started with.
+// Returns whether anything was copied, and sets *done if those are the final
+// results of the request.
+static bool32
+tldui_fuzzy_search_poll(tldui_fuzzy_search *search, tldui_top_k *result,
+                        int32_t *version, bool32 *done)
+{
+    tldui_fuzzy_search_lock(search);
+    
+    tldui_top_k *published = &search->published;
+    bool32 changed = (search->published_generation == search->generation &&
+                      search->published_version != *version);
+    if (changed) {
+        result->count = published->count;
+        memcpy(result->indices, published->indices, sizeof(int32_t) * published->count);
+        memcpy(result->scores, published->scores, sizeof(int32_t) * published->count);
+        *version = search->published_version;
+        *done = search->published_done;
+    }
+    
+    tldui_fuzzy_search_unlock(search);
+    return changed;
+}
+
+// 
+// Result Memo
+// 
+
+#ifndef TLDUI_FUZZY_MEMO_SIZE
+#define TLDUI_FUZZY_MEMO_SIZE (256 << 10)
+#endif
+
+// A remembered result set, followed in memory by its pattern, indices and
+// scores
+struct tldui_memo_entry {
+    tldui_memo_entry *prev;
+    tldui_memo_entry *next;
+    
+    int32_t size;
+    int32_t pattern_size;
+    int32_t count;
+    int32_t capacity;
+};
+
+// The ranked results of recent patterns for one corpus, so that a fuzzy list
+// query can show them without scoring anything when a pattern is typed again.
+// Entries are kept in least recently used order, and evicted once they take
+// up more than TLDUI_FUZZY_MEMO_SIZE bytes. All of them are dropped once the
+// corpus changes, or the memo is used with a different one.
+struct tldui_fuzzy_memo {
+    tldui_memo_entry *first;
+    tldui_memo_entry *last;
+    int32_t size;
+    
+    uint64_t corpus_generation;
+};
+
+static inline char *
+tldui_memo_entry_pattern(tldui_memo_entry *entry) {
+    return (char *)(entry + 1);
+}
+
+static inline int32_t *
+tldui_memo_entry_indices(tldui_memo_entry *entry) {
+    return (int32_t *)(entry + 1) + (entry->pattern_size + 3) / 4;
+}
+
+static void
+tldui_fuzzy_memo_unlink(tldui_fuzzy_memo *memo, tldui_memo_entry *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        memo->first = entry->next;
+    }
+    
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        memo->last = entry->prev;
+    }
+}
+
+static void
+tldui_fuzzy_memo_link_first(tldui_fuzzy_memo *memo, tldui_memo_entry *entry) {
+    entry->prev = 0;
+    entry->next = memo->first;
+    if (memo->first) {
+        memo->first->prev = entry;
+    } else {
+        memo->last = entry;
+    }
+    memo->first = entry;
+}
+
+static void
+tldui_fuzzy_memo_free(tldui_fuzzy_memo *memo) {
+    tldui_memo_entry *entry = memo->first;
+    while (entry) {
+        tldui_memo_entry *next = entry->next;
+        free(entry);
+        entry = next;
+    }
+    
+    *memo = {0};
+}
+
+// Copies the results remembered for the pattern to result, which needs at
+// least the capacity they were stored with or as many entries as there are
+// matches, and returns whether there were any.
+static bool32
+tldui_fuzzy_memo_find(tldui_fuzzy_memo *memo, tldui_fuzzy_corpus *corpus,
+                      String pattern, tldui_top_k *result)
+{
+    if (memo->corpus_generation != corpus->generation) {
+        tldui_fuzzy_memo_free(memo);
+        memo->corpus_generation = corpus->generation;
+    }
+    
+    for (tldui_memo_entry *entry = memo->first; entry; entry = entry->next) {
+        String entry_pattern = make_string(tldui_memo_entry_pattern(entry), entry->pattern_size);
+        if (!match_ss(entry_pattern, pattern)) continue;
+        
+        // A truncated result set can't fill a larger one
+        if (entry->count == entry->capacity && entry->capacity < result->capacity) break;
+        
+        int32_t *indices = tldui_memo_entry_indices(entry);
+        result->count = min(entry->count, result->capacity);
+        memcpy(result->indices, indices, sizeof(int32_t) * result->count);
+        memcpy(result->scores, indices + entry->count, sizeof(int32_t) * result->count);
+        
+        tldui_fuzzy_memo_unlink(memo, entry);
+        tldui_fuzzy_memo_link_first(memo, entry);
+        return true;
+    }
+    
+    return false;
+}
+
+// Remembers the final results of the pattern, in ranking order, replacing any
+// earlier results for it
+static void
+tldui_fuzzy_memo_store(tldui_fuzzy_memo *memo, tldui_fuzzy_corpus *corpus,
+                       String pattern, tldui_top_k *result)
+{
+    if (memo->corpus_generation != corpus->generation) {
+        tldui_fuzzy_memo_free(memo);
+        memo->corpus_generation = corpus->generation;
+    }
+    
+    for (tldui_memo_entry *entry = memo->first; entry; entry = entry->next) {
+        String entry_pattern = make_string(tldui_memo_entry_pattern(entry), entry->pattern_size);
+        if (match_ss(entry_pattern, pattern)) {
+            tldui_fuzzy_memo_unlink(memo, entry);
+            memo->size -= entry->size;
+            free(entry);
+            break;
+        }
+    }
+    
+    int32_t size = (int32_t)(sizeof(tldui_memo_entry) + 4 * ((pattern.size + 3) / 4) +
+                             2 * sizeof(int32_t) * result->count);
+    if (size > TLDUI_FUZZY_MEMO_SIZE) return;
+    
+    while (memo->last && memo->size + size > TLDUI_FUZZY_MEMO_SIZE) {
+        tldui_memo_entry *entry = memo->last;
+        tldui_fuzzy_memo_unlink(memo, entry);
+        memo->size -= entry->size;
+        free(entry);
+    }
+    
+    tldui_memo_entry *entry = (tldui_memo_entry *) malloc(size);
+    if (entry == 0) return;
+    
+    entry->size = size;
+    entry->pattern_size = pattern.size;
+    entry->count = result->count;
+    entry->capacity = result->capacity;
+    memcpy(tldui_memo_entry_pattern(entry), pattern.str, pattern.size);
+    
+    int32_t *indices = tldui_memo_entry_indices(entry);
+    memcpy(indices, result->indices, sizeof(int32_t) * result->count);
+    memcpy(indices + result->count, result->scores, sizeof(int32_t) * result->count);
+    
+    tldui_fuzzy_memo_link_first(memo, entry);
+    memo->size += size;
+}
+
+#endif
@@ -14,17 +14,26 @@ making this a strict dependency no matter which one you're using.
 
 Preprocessor Variables:
 * TLD_USER_INTERFACE_H is the include guard
-* TLDUI_MAX_PATTERN_SIZE is the maximum length the fuzzy matcher supports. This
-  defaults to 64, which is the highest valid value. Using other values is not
-  recommended, but possible.
-* TLDUI_TRANSPOSE_PATTERNS is not defined by default. If this macro is defined,
-  tldui_query_fuzzy_list will try a number of transpositions of each string,
-  yielding larger result sets and resistance to typos in the pattern, at the
-  cost of a noticeable performance drop when querying large lists.
+* TLDUI_FUZZY_RESULT_COUNT is the number of results tldui_query_fuzzy_list
+  shows at once. Callers decide how many ranked results can be paged through.
+  This defaults to 7.
+* TLDUI_FUZZY_TIME_SLICE is the number of milliseconds tldui_query_fuzzy_list
+  waits for a keystroke to be scored before it shows the best matches found so
+  far and goes back to reading input. The scan continues in the background,
+  and its results are shown every frame until it completes. This defaults
+  to 16.
+* TLDUI_VLIST_WINDOW is the number of rows of a virtualized list that are
+  printed into its buffer at once. This defaults to 160.
+* TLDUI_VLIST_MARGIN is the number of rows a virtualized list keeps printed
+  above and below the row it shows, before its window is moved. This
+  defaults to 40, and must be less than half of TLDUI_VLIST_WINDOW.
+* The fuzzy matcher's variables are documented in 4tld_fuzzy_match.h.
 ******************************************************************************/
 #ifndef TLD_USER_INTERFACE_H
 #define TLD_USER_INTERFACE_H
 
+#include "4tld_fuzzy_match.h"
+
 static inline Buffer_Summary
 tldui_get_empty_buffer_by_name(Application_Links *app,
                                char * buffer_name, int32_t buffer_name_len,
@@ -196,6 +205,114 @@ tld_handle_query_bar_input(Application_Links *app,
 // UI Printing
 // 
 
+// A batch of text that replaces a range of a buffer (or is appended to it) in
+// a single edit when the batch ends, rather than one edit per printed piece.
+// The ranges returned by the tldui_batch_print_* functions are those their
+// text occupies in the buffer once the batch ends.
+// If the batch runs out of memory, nothing is written.
+struct tldui_batch {
+    Buffer_Summary *buffer;
+    Range replaced;
+    
+    char *text;
+    int32_t size;
+    int32_t capacity;
+    bool32 failed;
+};
+
+static inline tldui_batch
+tldui_begin_batch(Buffer_Summary *buffer, Range replaced) {
+    tldui_batch result = {0};
+    result.buffer = buffer;
+    result.replaced = replaced;
+    return result;
+}
+
+static inline tldui_batch
+tldui_begin_batch_append(Buffer_Summary *buffer) {
+    return tldui_begin_batch(buffer, make_range(buffer->size, buffer->size));
+}
+
+// Returns room for len more characters, or 0 if the batch failed
+static char *
+tldui_batch_push(tldui_batch *batch, int32_t len) {
+    if (batch->failed) return 0;
+    
+    if (batch->capacity - batch->size < len) {
+        int32_t capacity = max(max(2 * batch->capacity, batch->size + len), 4096);
+        char *text = (char *) realloc(batch->text, capacity);
+        if (text == 0) {
+            batch->failed = true;
+            return 0;
+        }
+        
+        batch->text = text;
+        batch->capacity = capacity;
+    }
+    
+    char *result = batch->text + batch->size;
+    batch->size += len;
+    return result;
+}
+
+// Where the next character printed will end up
+static inline int32_t
+tldui_batch_pos(tldui_batch *batch) {
+    return batch->replaced.min + batch->size;
+}
+
+static inline Range
+tldui_batch_print_text(tldui_batch *batch, char *text, int32_t len) {
+    Range result = make_range(tldui_batch_pos(batch), tldui_batch_pos(batch) + len);
+    
+    char *dest = tldui_batch_push(batch, len);
+    if (dest) memcpy(dest, text, len);
+    
+    return result;
+}
+
+static inline void
+tldui_batch_print_spaces(tldui_batch *batch, int32_t count) {
+    char *dest = tldui_batch_push(batch, count);
+    if (dest) memset(dest, ' ', count);
+}
+
+// Prints text, padded with spaces to text.memory_size, so that it can be
+// updated in place with tldui_update_dynamic_text
+static inline Range
+tldui_batch_print_dynamic_text(tldui_batch *batch, String text) {
+    Assert(text.memory_size);
+    Range result = tldui_batch_print_text(batch, text.str, text.size);
+    tldui_batch_print_spaces(batch, text.memory_size - text.size);
+    return result;
+}
+
+static inline Range
+tldui_batch_print_checkbox(tldui_batch *batch, char *label, int32_t label_length, bool32 state) {
+    Range result = tldui_batch_print_text(batch, state ? (char *) "[x] " : (char *) "[ ] ", 4);
+    result.max = tldui_batch_print_text(batch, label, label_length).max;
+    return result;
+}
+
+// Writes the batch to its buffer and frees it.
+// Returns whether the text was written.
+static bool32
+tldui_end_batch(Application_Links *app, tldui_batch *batch) {
+    bool32 result = false;
+    if (!batch->failed) {
+        result = buffer_replace_range(app, batch->buffer,
+                                      batch->replaced.min, batch->replaced.max,
+                                      batch->text, batch->size);
+    }
+    
+    free(batch->text);
+    batch->text = 0;
+    batch->size = 0;
+    batch->capacity = 0;
+    
+    return result;
+}
+
 static inline Range
 tldui_print_text(Application_Links *app, Buffer_Summary *buffer, char *text, int32_t len) {
     Range result = make_range(buffer->size, buffer->size + len);
@@ -207,29 +324,21 @@ static inline Range
 tldui_update_dynamic_text(Application_Links *app, Buffer_Summary *buffer,
                           String text, Range text_loc)
 {
-    Range result = text_loc;
-    static const char padding[] = "                                "; // 32 Spaces
-    buffer_replace_range(app, buffer,
-                         text_loc.min, text_loc.min + text.memory_size,
-                         text.str, text.size);
-    result.max = text_loc.min + text.size;
-    
-    int32_t remaining = text.memory_size - text.size;
-    buffer_replace_range(app, buffer, result.max, result.max,
-                         (char *) padding, remaining % 32);
-    
-    for (int i = 0; i < remaining / 32; ++i) {
-        buffer_replace_range(app, buffer, result.max, result.max,
-                             (char *) padding, 32);
-    }
+    tldui_batch batch = tldui_begin_batch(
+        buffer, make_range(text_loc.min, text_loc.min + text.memory_size));
+    Range result = tldui_batch_print_dynamic_text(&batch, text);
+    tldui_end_batch(app, &batch);
     
     return result;
 }
 
 static inline Range
 tldui_print_dynamic_text(Application_Links *app, Buffer_Summary *buffer, String text) {
-    Assert(text.memory_size);
-    return tldui_update_dynamic_text(app, buffer, text, make_range(buffer->size, buffer->size));
+    tldui_batch batch = tldui_begin_batch_append(buffer);
+    Range result = tldui_batch_print_dynamic_text(&batch, text);
+    tldui_end_batch(app, &batch);
+    
+    return result;
 }
 
 enum tldui_update_result {
@@ -281,16 +390,9 @@ static inline Range
 tldui_print_checkbox(Application_Links *app, Buffer_Summary *buffer,
                      char * label, int32_t label_length, bool32 state)
 {
-    Range result = make_range(buffer->size, buffer->size);
-    
-    if (state) {
-        buffer_replace_range(app, buffer, buffer->size, buffer->size, literal("[x] "));
-    } else {
-        buffer_replace_range(app, buffer, buffer->size, buffer->size, literal("[ ] "));
-    }
-    
-    buffer_replace_range(app, buffer, buffer->size, buffer->size, label, label_length);
-    result.max += label_length + 4;
+    tldui_batch batch = tldui_begin_batch_append(buffer);
+    Range result = tldui_batch_print_checkbox(&batch, label, label_length, state);
+    tldui_end_batch(app, &batch);
     
     return result;
 }
@@ -308,17 +410,17 @@ tldui_toggle_checkbox(Application_Links *app, Buffer_Summary *buffer,
 }
 
 struct tldui_table_printer {
-    Buffer_Summary *target;
+    tldui_batch *target;
     int32_t column_width;
     int32_t current_column;
     int32_t column_count;
 };
 
 static tldui_table_printer
-tldui_make_table(Buffer_Summary * target_buffer, uint32_t column_width, int32_t column_count) {
+tldui_make_table(tldui_batch *target, uint32_t column_width, int32_t column_count) {
     tldui_table_printer result;
     
-    result.target = target_buffer;
+    result.target = target;
     result.column_width = column_width;
     result.column_count = column_count;
     result.current_column = 0;
@@ -326,307 +428,462 @@ tldui_make_table(Buffer_Summary * target_buffer, uint32_t column_width, int32_t
     return result;
 }
 
-static Range
-tldui_print_table_cell(Application_Links *app, tldui_table_printer *printer, String text) {
-    Assert(printer->column_width <= 40);
-    const char spaces[41] = "                                        ";
+// Moves the printer past a cell of text_size characters without printing it.
+// Returns whether the cell starts a new row.
+static bool32
+tldui_layout_table_cell(tldui_table_printer *printer, int32_t text_size) {
+    bool32 result = false;
     
     int32_t max_width = printer->column_count * printer->column_width;
-    int32_t projected_width = printer->current_column * printer->column_width + text.size;
+    int32_t projected_width = printer->current_column * printer->column_width + text_size;
     
     if (printer->current_column > 0 && projected_width > max_width) {
-        buffer_replace_range(app, printer->target, printer->target->size,
-                             printer->target->size, literal("\n"));
         printer->current_column = 0;
+        result = true;
     }
     
-    Range result;
-    result.min = printer->target->size;
-    result.max = result.min + text.size;
+    printer->current_column += 1 + text_size / printer->column_width;
+    return result;
+}
+
+static Range
+tldui_print_table_cell(tldui_table_printer *printer, String text) {
+    if (tldui_layout_table_cell(printer, text.size)) {
+        tldui_batch_print_text(printer->target, literal("\n"));
+    }
     
-    buffer_replace_range(app, printer->target, printer->target->size,
-                         printer->target->size, expand_str(text));
-    buffer_replace_range(app, printer->target, printer->target->size,
-                         printer->target->size, (char *) &spaces,
-                         printer->column_width - (text.size % printer->column_width));
+    Range result = tldui_batch_print_text(printer->target, expand_str(text));
+    tldui_batch_print_spaces(printer->target,
+                             printer->column_width - (text.size % printer->column_width));
     
-    printer->current_column += 1 + text.size / printer->column_width;
     return result;
 }
 
 // 
-// Fuzzy String Matching
+// Virtualized Lists
 // 
 
-#ifndef TLDUI_MAX_PATTERN_SIZE
-#define TLDUI_MAX_PATTERN_SIZE 64
+#ifndef TLDUI_VLIST_WINDOW
+#define TLDUI_VLIST_WINDOW 160
 #endif
 
-#ifndef min
-#define min(a, b) ((a) < (b) ? (a) : (b))
+#ifndef TLDUI_VLIST_MARGIN
+#define TLDUI_VLIST_MARGIN 40
 #endif
 
-#ifndef max
-#define max(a, b) ((a) > (b) ? (a) : (b))
-#endif
+// Prints a row of a virtualized list, including its trailing newline
+typedef void tldui_vlist_print_row_function(tldui_batch *batch, int32_t row, void *user_data);
+
+// A list whose rows live in memory, only a window of TLDUI_VLIST_WINDOW rows
+// of which is printed into the buffer below a fixed header. The window moves
+// when a row close to its edges is shown, so the buffer stays small no matter
+// how many rows there are.
+// Positions of the text in rows outside the window are meaningless, so keep
+// print_row's ranges around only while the row is printed.
+struct tldui_vlist {
+    tldui_vlist_print_row_function *print_row;
+    void *user_data;
+    
+    int32_t header_size;
+    int32_t row_count;
+    
+    // The rows [first_row, end_row) are printed, row_starts[i] is where
+    // first_row + i starts, row_starts[end_row - first_row] is the buffer's end
+    int32_t first_row;
+    int32_t end_row;
+    int32_t row_starts[TLDUI_VLIST_WINDOW + 1];
+};
 
-static inline b32_4tech
-tld_char_is_separator(char a) {
-    return (a == ' ' || a == '_' || a == '-' ||
-            a == '.' || a == '/' || a == '\\');
+static inline void
+tldui_vlist_init(tldui_vlist *list, int32_t header_size, int32_t row_count,
+                 tldui_vlist_print_row_function *print_row, void *user_data)
+{
+    list->print_row = print_row;
+    list->user_data = user_data;
+    list->header_size = header_size;
+    list->row_count = row_count;
+    list->first_row = 0;
+    list->end_row = 0;
+    list->row_starts[0] = header_size;
 }
 
-static inline b32_4tech
-tld_fuzzy_match_char(char a, char b) {
-    return ((char_to_lower(a) == char_to_lower(b)) ||
-            (a == ' ' && tld_char_is_separator(b)));
+static inline bool32
+tldui_vlist_is_printed(tldui_vlist *list, int32_t row) {
+    return list->first_row <= row && row < list->end_row;
 }
 
-// This is where the magic happens
+// Returns the row printed at pos, or -1 if there is none
 static int32_t
-tld_fuzzy_match_ss(String pattern, String val) {
-    if (pattern.size == 0) {
-        return 1;
+tldui_vlist_row_at_pos(tldui_vlist *list, int32_t pos) {
+    int32_t printed_count = list->end_row - list->first_row;
+    if (printed_count == 0) return -1;
+    if (pos < list->row_starts[0] || pos > list->row_starts[printed_count]) return -1;
+    
+    int32_t lo = 0, hi = printed_count - 1;
+    while (lo < hi) {
+        int32_t mid = (lo + hi + 1) / 2;
+        if (list->row_starts[mid] <= pos) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    
+    return list->first_row + lo;
+}
+
+// Prints the window starting at first_row into batch, which must be
+// positioned at the end of the list's header
+static void
+tldui_vlist_print_window(tldui_vlist *list, tldui_batch *batch, int32_t first_row) {
+    Assert(tldui_batch_pos(batch) == list->header_size);
+    
+    if (first_row > list->row_count - TLDUI_VLIST_WINDOW) {
+        first_row = list->row_count - TLDUI_VLIST_WINDOW;
     }
+    if (first_row < 0) first_row = 0;
     
-    // Optimization 1: Skip table rows
-    int j = 0;
-    while (j < val.size && !tld_fuzzy_match_char(pattern.str[0], val.str[j])) {
-        j++;
+    list->first_row = first_row;
+    list->end_row = min(first_row + TLDUI_VLIST_WINDOW, list->row_count);
+    
+    for (int32_t row = list->first_row; row < list->end_row; ++row) {
+        list->row_starts[row - list->first_row] = tldui_batch_pos(batch);
+        list->print_row(batch, row, list->user_data);
+    }
+    list->row_starts[list->end_row - list->first_row] = tldui_batch_pos(batch);
+}
+
+static inline float
+tldui_vlist_pos_y(Application_Links *app, View_Summary *view, int32_t pos) {
+    Full_Cursor cursor = {0};
+    view_compute_cursor(app, view, seek_pos(pos), &cursor);
+    return view->unwrapped_lines ? cursor.unwrapped_y : cursor.wrapped_y;
+}
+
+// Prints the window starting at first_row in the buffer shown by view.
+// If the row at the top of the view is still printed afterwards, the view is
+// scrolled so that it doesn't seem to move, otherwise it is scrolled to
+// focus_row.
+static void
+tldui_vlist_render(Application_Links *app, View_Summary *view, tldui_vlist *list,
+                   int32_t first_row, int32_t focus_row)
+{
+    Buffer_Summary buffer = get_buffer(app, view->buffer_id, AccessAll);
+    if (!buffer.exists) return;
+    
+    Full_Cursor top = {0};
+    view_compute_cursor(app, view, seek_xy(0, view->scroll_vars.scroll_y, 1, view->unwrapped_lines), &top);
+    int32_t top_row = tldui_vlist_row_at_pos(list, top.pos);
+    float top_offset = 0;
+    if (top_row >= 0) {
+        top_offset = view->scroll_vars.scroll_y -
+            tldui_vlist_pos_y(app, view, list->row_starts[top_row - list->first_row]);
     }
     
-    if (val.size - j < pattern.size) {
-        return 0;
+    tldui_batch batch = tldui_begin_batch(&buffer, make_range(list->header_size, buffer.size));
+    tldui_vlist_print_window(list, &batch, first_row);
+    tldui_end_batch(app, &batch);
+    
+    float scroll_y = 0;
+    if (top_row >= 0 && tldui_vlist_is_printed(list, top_row)) {
+        scroll_y = top_offset +
+            tldui_vlist_pos_y(app, view, list->row_starts[top_row - list->first_row]);
+    } else if (tldui_vlist_is_printed(list, focus_row)) {
+        float view_height = (float)(view->file_region.y1 - view->file_region.y0);
+        scroll_y = tldui_vlist_pos_y(app, view, list->row_starts[focus_row - list->first_row]);
+        scroll_y -= view_height / 3;
+        if (scroll_y < 0) scroll_y = 0;
+    } else {
+        return;
     }
     
-    int32_t row[TLDUI_MAX_PATTERN_SIZE] = {0}; // Current row of scores table
-    int32_t lml[TLDUI_MAX_PATTERN_SIZE] = {0}; // Current row of auxiliary table (match lengths)
+    GUI_Scroll_Vars scroll = view->scroll_vars;
+    scroll.scroll_y = scroll_y;
+    scroll.target_y = (int32_t) scroll_y;
+    view_set_scroll(app, view, scroll);
+}
+
+// Makes sure row is printed, with TLDUI_VLIST_MARGIN rows around it wherever
+// the list has them, moving the window if necessary.
+// Returns whether the window moved.
+static bool32
+tldui_vlist_show_row(Application_Links *app, View_Summary *view, tldui_vlist *list, int32_t row) {
+    Assert(TLDUI_VLIST_WINDOW > 2 * TLDUI_VLIST_MARGIN);
     
-    int j_lo = j;
+    bool32 near_top = row - list->first_row < TLDUI_VLIST_MARGIN && list->first_row > 0;
+    bool32 near_bottom = list->end_row - row <= TLDUI_VLIST_MARGIN && list->end_row < list->row_count;
+    if (tldui_vlist_is_printed(list, row) && !near_top && !near_bottom) return false;
+    
+    tldui_vlist_render(app, view, list, row - TLDUI_VLIST_WINDOW / 2, row);
+    return true;
+}
+
+// 
+// Fuzzy List Queries
+// 
+
+#ifndef TLDUI_FUZZY_RESULT_COUNT
+#define TLDUI_FUZZY_RESULT_COUNT 7
+#endif
+
+#ifndef TLDUI_FUZZY_TIME_SLICE
+#define TLDUI_FUZZY_TIME_SLICE 16
+#endif
+
+// The result lines shown below the search bar of a fuzzy list query. Their
+// query bars are started once the first results come in and are kept alive
+// until the query ends, lines without a result are left blank. Each line
+// keeps its highlighted text until it shows a different result or the
+// results of a different pattern, so an update that barely changes the
+// results barely costs anything.
+struct tldui_result_slots {
+    Query_Bar bars[TLDUI_FUZZY_RESULT_COUNT];
+    int32_t live_count;
+    
+    int32_t indices[TLDUI_FUZZY_RESULT_COUNT];
+    int32_t pattern_versions[TLDUI_FUZZY_RESULT_COUNT];
+    String text[TLDUI_FUZZY_RESULT_COUNT];
+    tld_fuzzy_scratch text_memory[TLDUI_FUZZY_RESULT_COUNT];
+    tld_fuzzy_scratch trace_scratch;
+};
+
+static inline void
+tldui_result_slot_set(Query_Bar *bar, String prompt, String string) {
+    if (bar->prompt.str != prompt.str || bar->prompt.size != prompt.size) {
+        bar->prompt = prompt;
+    }
+    if (bar->string.str != string.str || bar->string.size != string.size) {
+        bar->string = string;
+    }
+}
+
+// Shows count results, with the one at selected highlighted as selected.
+// pattern_version identifies the pattern the results were ranked for, lines
+// are only highlighted again if it changed or they show a different result.
+static void
+tldui_result_slots_update(Application_Links *app,
+                          tldui_result_slots *slots,
+                          Query_Bar *search_bar,
+                          tldui_fuzzy_corpus *corpus,
+                          int32_t *indices, int32_t count,
+                          int32_t selected, int32_t pattern_version)
+{
+    String empty = make_lit_string("");
     
-    for (; j < val.size; ++j) {
-        int32_t diag = 1;
-        int32_t diag_l = 0;
+    if (count > slots->live_count) {
+        // New lines have to go below the others, and the search bar on top
+        end_query_bar(app, search_bar, 0);
+        for (int32_t i = 0; i < slots->live_count; ++i) {
+            end_query_bar(app, &slots->bars[i], 0);
+        }
         
-        // Optimization 2: Skip triangular table sections that don't affect the result
-        int i_lo = max(j + pattern.size - val.size, 0);
-        int i_hi = min(j - j_lo + 1, pattern.size);
+        for (int32_t i = slots->live_count; i < count; ++i) {
+            slots->bars[i].prompt = empty;
+            slots->bars[i].string = empty;
+            slots->indices[i] = -1;
+        }
         
-        if (i_lo > 0) {
-            diag = row[i_lo - 1];
-            diag_l = lml[i_lo - 1];
+        slots->live_count = count;
+        for (int32_t i = count - 1; i >= 0; --i) {
+            start_query_bar(app, &slots->bars[i], 0);
+        }
+        start_query_bar(app, search_bar, 0);
+    }
+    
+    for (int32_t i = 0; i < slots->live_count; ++i) {
+        if (i >= count) {
+            slots->indices[i] = -1;
+            tldui_result_slot_set(&slots->bars[i], empty, empty);
+            continue;
         }
         
-        for (int i = i_lo; i < i_hi; ++i) {
-            int32_t row_old = row[i];
-            int32_t lml_old = lml[i];
-            
-            int32_t match = tld_fuzzy_match_char(pattern.str[i], val.str[j]);
-            lml[i] = match * (diag_l + 1);
+        int32_t index = indices[i];
+        if (slots->indices[i] != index || slots->pattern_versions[i] != pattern_version) {
+            slots->indices[i] = index;
+            slots->pattern_versions[i] = pattern_version;
             
-            if (diag > 0 && match) {
-                // Sequential match bonus:
-                int32_t value = lml[i];
-                
-                if (j == 0 || (char_is_lower(val.str[j - 1]) && char_is_upper(val.str[j])) ||
-                    tld_char_is_separator(val.str[j - 1]))
-                {   // Abbreviation bonus:
-                    value += 4;
-                }
-                
-                row[i] = max(diag + value, row[i]);
+            String value = tldui_fuzzy_corpus_get(corpus, index);
+            char *text = (char *) tld_fuzzy_scratch_reserve(&slots->text_memory[i],
+                                                            2 * value.size + 1);
+            if (text) {
+                slots->text[i] = tldui_fuzzy_highlight(corpus, index, search_bar->string,
+                                                       &slots->trace_scratch, text);
+            } else {
+                slots->text[i] = value;
             }
-            
-            diag = row_old;
-            diag_l = lml_old;
+        }
+        
+        if (i == selected) {
+            tldui_result_slot_set(&slots->bars[i], slots->text[i], empty);
+        } else {
+            tldui_result_slot_set(&slots->bars[i], empty, slots->text[i]);
         }
     }
-    
-    return row[pattern.size - 1];
 }
 
-// A string that tracks whether it matched patterns of a given length
-struct tldui_string {
-    String value;
-    // The length of the longest prefix of the current pattern this string matched
-    uint64_t matched_pattern_prefix_length;
-};
+static void
+tldui_result_slots_end(Application_Links *app, tldui_result_slots *slots) {
+    for (int32_t i = 0; i < slots->live_count; ++i) {
+        end_query_bar(app, &slots->bars[i], 0);
+    }
+    
+    for (int32_t i = 0; i < ArrayCount(slots->text_memory); ++i) {
+        tld_fuzzy_scratch_free(&slots->text_memory[i]);
+    }
+    tld_fuzzy_scratch_free(&slots->trace_scratch);
+    slots->live_count = 0;
+}
 
-// Query a user for a pattern to search the list with, show the top 7 results
+// Query a user for a pattern to search the corpus with, rank the best
+// result_capacity matches and show them TLDUI_FUZZY_RESULT_COUNT at a time
 // (or fewer, if not enough strings match the pattern, even with a low score).
-// Navigate the result list with the arrow keys, press enter to accept the
-// selected string.
+// Navigate the result list with the arrow keys and page up/down, press enter
+// to accept the selected string. Paging only moves through the ranked results,
+// it doesn't score anything. The matched characters of the results shown are
+// put in brackets.
+// Scoring runs in the background, see tldui_fuzzy_search, so typing never
+// waits for more than TLDUI_FUZZY_TIME_SLICE milliseconds. Until a scan
+// completes, the best matches it found so far are shown, and enter waits for
+// it to complete before accepting one.
+// If memo is not 0, the results of every completed scan are remembered in it,
+// and patterns it has results for are not scored again. Keep one memo per
+// corpus around between queries to benefit from this.
 // 
-// Returns the index of the selected string in the provided string list,
+// Returns the index of the selected string in the corpus,
 // or -1 if the query was canceled with ESC.
 static int32_t
 tldui_query_fuzzy_list(Application_Links *app,
                        Query_Bar *search_bar,
-                       tldui_string *list,
-                       int32_t list_count)
+                       tldui_fuzzy_corpus *corpus,
+                       int32_t result_capacity,
+                       tldui_fuzzy_memo *memo)
 {
-    int32_t result_indices[7];
+    result_capacity = max(result_capacity, 1);
+    int32_t *result_memory = (int32_t *) malloc(sizeof(int32_t) * 2 * result_capacity);
+    if (result_memory == 0) {
+        return -1;
+    }
     
-    String empty = make_lit_string("");
-    Query_Bar result_bars[ArrayCount(result_indices)] = {0};
-    for (int i = 0; i < ArrayCount(result_indices); ++i) {
-        result_bars[i].string = empty;
-        result_bars[i].prompt = empty;
+    tldui_fuzzy_search search;
+    if (!tldui_fuzzy_search_start(&search, corpus, result_capacity,
+                                  search_bar->string.memory_size))
+    {
+        free(result_memory);
+        return -1;
     }
     
+    tldui_top_k results = tldui_make_top_k(result_memory, result_memory + result_capacity,
+                                           result_capacity);
+    int32_t *result_indices = results.indices;
+    
+    tldui_result_slots slots = {0};
+    int32_t page_size = ArrayCount(slots.bars);
+    
     int result_count = 0;
     int result_selected_index = 0;
-    bool full_rescan = true;
-    int current_min = 0;
+    int32_t result_version = 0;
+    int32_t pattern_version = 0;
+    int32_t result_pattern_version = 0;
+    bool32 results_done = false;
     bool search_key_changed = true;
     bool selected_index_changed = true;
+    bool results_changed = false;
     
     while (true) {
         if (search_key_changed) {
-            end_query_bar(app, search_bar, 0);
-            result_selected_index = 0;
-            
-            for (int i = result_count - 1; i >= 0; --i) {
-                end_query_bar(app, &result_bars[i], 0);
-            }
-            result_count = 0;
-            
-            int32_t min_score = 0x7FFFFFFF;
-            int32_t min_index = -1;
+            pattern_version += 1;
             
-            int32_t result_scores[ArrayCount(result_indices)];
-            
-            for (int i = 0; i < list_count; ++i) {
-                String candidate = list[i].value;
+            if (memo && tldui_fuzzy_memo_find(memo, corpus, search_bar->string, &results)) {
+                tldui_fuzzy_search_cancel(&search);
+                result_count = results.count;
+                results_done = true;
+            } else {
+                tldui_fuzzy_search_request(&search, search_bar->string);
+                tldui_fuzzy_search_wait(&search, TLDUI_FUZZY_TIME_SLICE);
                 
-                if (full_rescan || list[i].matched_pattern_prefix_length >= current_min) {
-                    int32_t score = tld_fuzzy_match_ss(search_bar->string, candidate);
-#ifdef TLDUI_TRANSPOSE_PATTERNS
-                    for (int j = 1; j < search_bar->string.size; ++j) {
-                        char temp = search_bar->string.str[j - 1];
-                        search_bar->string.str[j - 1] = search_bar->string.str[j];
-                        search_bar->string.str[j] = temp;
-                        
-                        int32_t score_transpose = tld_fuzzy_match_ss(search_bar->string, candidate) / 4;
-                        
-                        search_bar->string.str[j] = search_bar.str[j - 1];
-                        search_bar->string.str[j - 1] = temp;
-                        
-                        if (score < score_transpose) {
-                            score = score_transpose;
-                        }
-                    }
-#endif
-                    
-                    if (score > 0) {
-                        list[i].matched_pattern_prefix_length = search_bar->string.size;
-                        
-                        if (result_count < ArrayCount(result_indices)) {
-                            result_indices[result_count] = i;
-                            result_scores[result_count] = score;
-                            
-                            if (score > min_score) {
-                                min_score = score;
-                                min_index = result_count;
-                            }
-                            
-                            ++result_count;
-                        } else if (score > result_scores[min_index]) {
-                            result_indices[min_index] = i;
-                            result_scores[min_index] = score;
-                            
-                            min_index = 0;
-                            min_score = result_scores[0];
-                            
-                            for (int j = 1; j <= ArrayCount(result_indices); ++j) {
-                                if (result_scores[j] < min_score) {
-                                    min_score = result_scores[j];
-                                    min_index = j;
-                                }
-                            }
-                        }
-                    }
-                }
+                // The results shown were for the previous pattern
+                result_count = 0;
+                results_done = false;
             }
             
-            for (int i = 0; i < result_count - 1; ++i) {
-                int max = i;
-                for (int j = i + 1; j < result_count; ++j) {
-                    if (result_scores[j] > result_scores[max]) {
-                        max = j;
-                    }
-                }
-                
-                int32_t s = result_indices[i];
-                result_indices[i] = result_indices[max];
-                result_indices[max] = s;
-                
-                int32_t c = result_scores[i];
-                result_scores[i] = result_scores[max];
-                result_scores[max] = c;
-            }
+            results_changed = true;
+            result_selected_index = 0;
+            selected_index_changed = true;
+        }
+        
+        // Results of a scan in progress are picked up every frame
+        if (tldui_fuzzy_search_poll(&search, &results, &result_version, &results_done)) {
+            result_count = results.count;
+            result_selected_index = max(min(result_selected_index, result_count - 1), 0);
+            results_changed = true;
             
-            for (int i = result_count - 1; i >= 0; --i) {
-                result_bars[i].string = list[result_indices[i]].value;
-                start_query_bar(app, &result_bars[i], 0);
+            if (memo && results_done) {
+                tldui_fuzzy_memo_store(memo, corpus, search_bar->string, &results);
             }
-            
-            start_query_bar(app, search_bar, 0);
         }
         
-        if (selected_index_changed || search_key_changed) {
-            for (int i = 0; i < result_count; ++i) {
-                if (i == result_selected_index) {
-                    result_bars[i].prompt = list[result_indices[i]].value;
-                    result_bars[i].string = empty;
-                } else {
-                    result_bars[i].prompt = empty;
-                    result_bars[i].string = list[result_indices[i]].value;
-                }
-            }
+        if (results_changed) {
+            result_pattern_version = pattern_version;
         }
         
-        User_Input in = get_user_input(app, EventOnAnyKey, EventOnEsc);
+        if (results_changed || selected_index_changed) {
+            int32_t page_first = result_selected_index - result_selected_index % page_size;
+            int32_t visible_count = max(min(result_count - page_first, page_size), 0);
+            
+            tldui_result_slots_update(app, &slots, search_bar, corpus,
+                                      result_indices + page_first, visible_count,
+                                      result_selected_index - page_first,
+                                      result_pattern_version);
+        }
+        
+        uint32_t get_type = EventOnAnyKey;
+        if (!results_done) get_type |= EventOnAnimate;
+        
+        User_Input in = get_user_input(app, get_type, EventOnEsc);
         selected_index_changed = false;
         search_key_changed = false;
-        full_rescan = false;
+        results_changed = false;
         
         if (in.abort) {
-            for (int i = 0; i < ArrayCount(result_indices); ++i) {
-                end_query_bar(app, &result_bars[i], 0);
-            }
-            
+            tldui_result_slots_end(app, &slots);
+            tldui_fuzzy_search_stop(&search);
+            free(result_memory);
             return -1;
         }
         
         if (in.type == UserInputKey) {
             if (in.key.keycode == '\n') {
+                if (!results_done) {
+                    tldui_fuzzy_search_wait(&search, -1);
+                    if (tldui_fuzzy_search_poll(&search, &results, &result_version, &results_done)) {
+                        result_count = results.count;
+                        result_selected_index = max(min(result_selected_index, result_count - 1), 0);
+                        results_changed = true;
+                        
+                        if (memo) {
+                            tldui_fuzzy_memo_store(memo, corpus, search_bar->string, &results);
+                        }
+                    }
+                }
+                
                 if (result_count > 0) {
                     if (result_selected_index < 0)
                         result_selected_index = 0;
                     
-                    for (int i = 0; i < ArrayCount(result_indices); ++i) {
-                        end_query_bar(app, &result_bars[i], 0);
-                    }
-                    
-                    return result_indices[result_selected_index];
+                    int32_t selected = result_indices[result_selected_index];
+                    tldui_result_slots_end(app, &slots);
+                    tldui_fuzzy_search_stop(&search);
+                    free(result_memory);
+                    return selected;
                 }
             } else if (in.key.keycode == key_back) {
                 if (search_bar->string.size > 0) {
                     backspace_utf8(&search_bar->string);
                     search_key_changed = true;
                 }
-                current_min = search_bar->string.size;
             } else if (in.key.keycode == key_del) {
                 search_bar->string.size = 0;
-                result_selected_index = 0;
-                
-                for (int i = result_count - 1; i >= 0; --i) {
-                    end_query_bar(app, &result_bars[i], 0);
-                }
-                
-                full_rescan = true;
-                current_min = 0;
+                search_key_changed = true;
             } else if (in.key.keycode == key_up) {
                 selected_index_changed = true;
                 
@@ -641,13 +898,18 @@ tldui_query_fuzzy_list(Application_Links *app,
                 if (result_selected_index >= result_count) {
                     result_selected_index = 0;
                 }
+            } else if (in.key.keycode == key_page_up) {
+                selected_index_changed = true;
+                result_selected_index = max(result_selected_index - page_size, 0);
+            } else if (in.key.keycode == key_page_down) {
+                selected_index_changed = true;
+                result_selected_index = min(result_selected_index + page_size, result_count - 1);
             } else if (key_is_unmodified(&in.key) && in.key.character != 0) {
                 uint8_t character[4];
                 uint32_t length = to_writable_character(in, character);
                 if (length != 0 && search_bar->string.memory_size - search_bar->string.size > (int32_t)length) {
                     append_ss(&search_bar->string, make_string((char *) &character, length));
                     search_key_changed = true;
-                    current_min = search_bar->string.size - 1;
                 }
             }
         }